@@ -0,0 +1,138 @@
+/*
+  Copyright (c) 2020, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Benchmark of the unscaled YUV to RGB conversions of FFMpegPixelConversion, at each instruction set level, against
+ * swscale, per format pair.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include "ffmpegpixelconvert.h"
+
+using media_handling::ffmpeg::FFMpegPixelConversion;
+using media_handling::ffmpeg::SimdLevel;
+
+constexpr auto WIDTH = 1920;
+constexpr auto HEIGHT = 1080;
+constexpr auto ITERATIONS = 100;
+
+namespace
+{
+  struct FrameDeleter
+  {
+      void operator()(AVFrame* frame) const
+      {
+        av_frame_free(&frame);
+      }
+  };
+  using FramePtr = std::unique_ptr<AVFrame, FrameDeleter>;
+
+  FramePtr makeFrame(const AVPixelFormat format)
+  {
+    FramePtr frame(av_frame_alloc());
+    frame->format = format;
+    frame->width = WIDTH;
+    frame->height = HEIGHT;
+    if (av_frame_get_buffer(frame.get(), 0) < 0) {
+      return nullptr;
+    }
+    // Every byte 1, which is a valid sample at any bit depth
+    for (auto plane = 0; (plane < AV_NUM_DATA_POINTERS) && (frame->buf[plane] != nullptr); ++plane) {
+      std::fill(frame->buf[plane]->data, frame->buf[plane]->data + frame->buf[plane]->size, 0x01);
+    }
+    return frame;
+  }
+
+  double millisPerFrame(const std::function<void()>& func)
+  {
+    func();
+    const auto start = std::chrono::steady_clock::now();
+    for (auto ix = 0; ix < ITERATIONS; ++ix) {
+      func();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / ITERATIONS;
+  }
+}
+
+int main()
+{
+  constexpr std::array<AVPixelFormat, 6> SOURCES {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUV422P,
+        AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_YUV422P10LE};
+  constexpr std::array<AVPixelFormat, 2> OUTPUTS {AV_PIX_FMT_RGBA, AV_PIX_FMT_RGB24};
+  constexpr std::array<SimdLevel, 4> LEVELS {SimdLevel::SCALAR, SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512};
+
+  std::printf("%dx%d, ms/frame, CPU supports up to level %d\n", WIDTH, HEIGHT,
+              static_cast<int>(media_handling::ffmpeg::detectSimdLevel()));
+  std::printf("%-26s %9s %9s %9s %9s %9s %9s\n", "conversion", "swscale", "scalar", "sse4", "avx2", "avx512",
+              "speedup");
+  for (const auto src_fmt : SOURCES) {
+    const auto src = makeFrame(src_fmt);
+    for (const auto dst_fmt : OUTPUTS) {
+      const auto dst = makeFrame(dst_fmt);
+      if (!src || !dst) {
+        std::printf("Failed to allocate frames\n");
+        return 1;
+      }
+      SwsContext* sws = sws_getContext(WIDTH, HEIGHT, src_fmt, WIDTH, HEIGHT, dst_fmt, SWS_BICUBIC,
+                                       nullptr, nullptr, nullptr);
+      const auto swscale = millisPerFrame([&] {
+        sws_scale(sws, src->data, src->linesize, 0, HEIGHT, dst->data, dst->linesize);
+      });
+      sws_freeContext(sws);
+
+      const auto name = std::string(av_get_pix_fmt_name(src_fmt)) + " -> " + av_get_pix_fmt_name(dst_fmt);
+      std::printf("%-26s %9.3f", name.c_str(), swscale);
+      double fastest = swscale;
+      for (const auto level : LEVELS) {
+        const auto conversion = FFMpegPixelConversion::find(src_fmt, dst_fmt, level);
+        if (!conversion || (conversion->level() != level)) {
+          std::printf(" %9s", "-");
+          continue;
+        }
+        const auto millis = millisPerFrame([&] { conversion->convert(*src, *dst); });
+        fastest = std::min(fastest, millis);
+        std::printf(" %9.3f", millis);
+      }
+      std::printf(" %8.1fx\n", swscale / fastest);
+    }
+  }
+  return 0;
+}
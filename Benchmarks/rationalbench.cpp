@@ -0,0 +1,152 @@
+/*
+  Copyright (c) 2020, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Micro-benchmark of the per-operation cost of media_handling::Rational.
+ * The "before" column is the brute-force gcd implementation the type used previously, kept here for comparison only.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include "types.h"
+#include "rational.h"
+
+using media_handling::Rational;
+
+constexpr auto ITERATIONS = 200'000;
+// The brute-force gcd is O(denominator) so it is sampled far less often
+constexpr auto LEGACY_ITERATIONS = 1'000;
+constexpr auto TIMEBASE = 90'000;
+
+namespace legacy
+{
+  struct Rational
+  {
+    int64_t numerator_ {0};
+    int64_t denominator_ {0};
+
+    Rational(const int64_t num, const int64_t denom) : numerator_(num), denominator_(denom)
+    {
+      const auto div = gcd();
+      if (div > 1LL) {
+        numerator_ /= div;
+        denominator_ /= div;
+      }
+    }
+    explicit Rational(const double num) : Rational(llround(num * DOUBLE_FUDGER), DOUBLE_FUDGER) {}
+
+    int64_t gcd() const
+    {
+      for (auto i = denominator_; i > 0; --i) {
+        if ( ((numerator_ % i) == 0) && ((denominator_ % i) == 0) ) {
+          return i;
+        }
+      }
+      return 1;
+    }
+    friend Rational operator*(const Rational& lhs, const Rational& rhs)
+    {
+      return {lhs.numerator_ * rhs.numerator_, lhs.denominator_ * rhs.denominator_};
+    }
+    friend Rational operator+(const Rational& lhs, const Rational& rhs)
+    {
+      return {(lhs.numerator_ * rhs.denominator_) + (rhs.numerator_ * lhs.denominator_),
+              lhs.denominator_ * rhs.denominator_};
+    }
+    friend bool operator<(const Rational& lhs, const Rational& rhs)
+    {
+      return (lhs.numerator_ * rhs.denominator_) < (rhs.numerator_ * lhs.denominator_);
+    }
+  };
+}
+
+namespace
+{
+  volatile int64_t sink;
+
+  double nanosPerOp(const std::function<int64_t(int64_t)>& func, const int iterations)
+  {
+    int64_t acc = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto ix = 0; ix < iterations; ++ix) {
+      acc += func(ix);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    sink = acc;
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  }
+
+  void report(const char* name, const std::function<int64_t(int64_t)>& before,
+              const std::function<int64_t(int64_t)>& after, const int before_iterations = LEGACY_ITERATIONS)
+  {
+    const auto b = nanosPerOp(before, before_iterations);
+    const auto a = nanosPerOp(after, ITERATIONS);
+    std::printf("%-28s %14.1f %14.1f %10.1fx\n", name, b, a, b / a);
+  }
+}
+
+int main()
+{
+  std::printf("%-28s %14s %14s %11s\n", "operation (ns/op)", "before", "after", "speedup");
+
+  report("construct(ts, 90000)",
+         [](int64_t ix) { return legacy::Rational(ix * 3'003 + 1, TIMEBASE).denominator_; },
+         [](int64_t ix) { return Rational(ix * 3'003 + 1, TIMEBASE).denominator(); });
+
+  report("construct(double)",
+         [](int64_t ix) { return legacy::Rational(29.97 + static_cast<double>(ix)).denominator_; },
+         [](int64_t ix) { return Rational(29.97 + static_cast<double>(ix)).denominator(); },
+         LEGACY_ITERATIONS / 10);
+
+  report("ts * timebase",
+         [](int64_t ix) { return (legacy::Rational(ix, 1) * legacy::Rational(1, TIMEBASE)).numerator_; },
+         [](int64_t ix) { return (Rational(ix) * Rational(1, TIMEBASE)).numerator(); });
+
+  // A 90kHz sum previously searched a 2.7e9 denominator per operation which is too slow to sample, so use 25fps
+  report("ts + frame duration",
+         [](int64_t ix) { return (legacy::Rational(ix, 25) + legacy::Rational(1, 25)).numerator_; },
+         [](int64_t ix) { return (Rational(ix, 25) + Rational(1, 25)).numerator(); });
+
+  const legacy::Rational l_rate(30'000, 1'001);
+  const Rational rate(30'000, 1'001);
+  report("compare",
+         [&](int64_t ix) { return static_cast<int64_t>(legacy::Rational(ix, TIMEBASE) < l_rate); },
+         [&](int64_t ix) { return static_cast<int64_t>(Rational(ix, TIMEBASE) < rate); });
+
+  std::vector<Rational> values;
+  values.reserve(ITERATIONS);
+  for (auto ix = 0; ix < ITERATIONS; ++ix) {
+    values.emplace_back(ix, TIMEBASE);
+  }
+  report("compare (pre-built)",
+         [&](int64_t ix) { return static_cast<int64_t>(values[static_cast<size_t>(ix)].toDouble() < rate.toDouble()); },
+         [&](int64_t ix) { return static_cast<int64_t>(values[static_cast<size_t>(ix)] < rate); });
+  return 0;
+}
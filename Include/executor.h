@@ -0,0 +1,144 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+namespace media_handling
+{
+  /**
+   * @brief A pool of worker threads shared by the library for work such as decoding ahead, conversion and encoding
+   * @note  Each worker has its own queue. Tasks submitted from a worker are queued on that worker, and idle workers
+   *        steal from the others, so that work spawned by a task tends to stay on the thread with its data cached.
+   *        Tasks should not block waiting on other tasks, except through parallelFor(). A task draining a queue
+   *        returns once the queue is empty, or full, rather than waiting for it to change, so that a worker is not
+   *        held idle; whoever next changes the queue submits another task if none is running
+   */
+  class EXPORT Executor
+  {
+    public:
+      using Task = std::function<void()>;
+
+      /**
+       * @param workers Number of worker threads. 0 for a worker per core
+       */
+      explicit Executor(const size_t workers);
+      ~Executor();
+
+      Executor(const Executor&) = delete;
+      Executor& operator=(const Executor&) = delete;
+
+      /**
+       * @brief The executor shared by the library, created with a worker per core on first use
+       */
+      static std::shared_ptr<Executor> global();
+      /**
+       * @brief         Replace the executor shared by the library
+       * @note          Work already submitted to the previous executor still runs on it
+       * @param workers Number of worker threads. 0 for a worker per core
+       * @see           media_handling::initialise
+       */
+      static void configure(const size_t workers);
+
+      /**
+       * @brief Queue a task to run on a worker
+       */
+      void submit(Task task);
+
+      /**
+       * @brief       Run a function for each index in [0, count) across the workers and the calling thread
+       * @note        The calling thread runs indices too, and waits only on those already being run by others, so this
+       *              may be called from within a task
+       * @param count Number of indices
+       * @param func  Function called once per index
+       */
+      void parallelFor(const size_t count, const std::function<void(size_t)>& func);
+
+      /**
+       * @brief Number of worker threads
+       */
+      size_t workers() const noexcept;
+      /**
+       * @brief Number of tasks queued and not yet started
+       */
+      size_t pending() const noexcept;
+      /**
+       * @brief Number of tasks run since creation
+       */
+      uint64_t completed() const noexcept;
+      /**
+       * @brief Number of tasks run by a worker other than the one they were queued on
+       */
+      uint64_t stolen() const noexcept;
+
+    private:
+      struct Worker
+      {
+          std::deque<Task> queue_;
+          std::mutex mutex_;
+          std::thread thread_;
+      };
+      std::vector<std::unique_ptr<Worker>> workers_;
+      std::mutex sleep_mutex_;
+      std::condition_variable wake_;
+      bool stop_ {false};
+      std::atomic<size_t> pending_ {0};
+      std::atomic<size_t> next_ {0};
+      std::atomic<uint64_t> completed_ {0};
+      std::atomic<uint64_t> stolen_ {0};
+
+    private:
+      /**
+       * @brief Body of a worker thread
+       */
+      void run(const size_t index);
+      /**
+       * @brief       Run one queued task, preferring the given worker's own queue
+       * @return      true==a task was run
+       */
+      bool runOne(const size_t index);
+      /**
+       * @brief The index of the worker the calling thread is, or the one to queue on next if it is not a worker
+       */
+      size_t currentWorker() noexcept;
+  };
+
+  using ExecutorPtr = std::shared_ptr<Executor>;
+}
+
+#endif // EXECUTOR_H
@@ -0,0 +1,110 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FRAMEBATCH_H
+#define FRAMEBATCH_H
+
+#include <vector>
+#include <cassert>
+
+#include "imediaframe.h"
+
+namespace media_handling
+{
+  /**
+   * @brief A reusable container of frames retrieved together from a stream
+   * @note  Frames no longer referenced outside of the batch are reused by the next retrieval into it, so keep the
+   *        same batch across retrievals and only hold on to those frames that are needed
+   */
+  class FrameBatch
+  {
+    public:
+      using const_iterator = std::vector<MediaFramePtr>::const_iterator;
+
+      size_t size() const noexcept
+      {
+        return size_;
+      }
+
+      bool empty() const noexcept
+      {
+        return size_ == 0;
+      }
+
+      const MediaFramePtr& operator[](const size_t index) const
+      {
+        assert(index < size_);
+        return frames_[index];
+      }
+
+      const_iterator begin() const noexcept
+      {
+        return frames_.cbegin();
+      }
+
+      const_iterator end() const noexcept
+      {
+        return frames_.cbegin() + static_cast<std::ptrdiff_t>(size_);
+      }
+
+      /**
+       * @brief Empty the batch, keeping its frames for reuse
+       */
+      void clear() noexcept
+      {
+        size_ = 0;
+      }
+
+      /**
+       * @brief Retrieve the slot of the next frame, which may hold a frame of a previous retrieval for reuse
+       * @note  For IMediaStream implementations. The frame only becomes part of the batch on commit()
+       */
+      MediaFramePtr& slot()
+      {
+        if (size_ == frames_.size()) {
+          frames_.emplace_back(nullptr);
+        }
+        return frames_[size_];
+      }
+
+      /**
+       * @brief Add the frame placed in slot() to the batch
+       */
+      void commit() noexcept
+      {
+        assert(size_ < frames_.size());
+        assert(frames_[size_]);
+        ++size_;
+      }
+
+    private:
+      std::vector<MediaFramePtr> frames_;
+      size_t size_ {0};
+  };
+}
+
+#endif // FRAMEBATCH_H
@@ -0,0 +1,66 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef IBUFFERALLOCATOR_H
+#define IBUFFERALLOCATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace media_handling
+{
+  /**
+   * @brief Application-owned memory for frame data i.e. pinned host memory, shared memory or mapped files
+   * @note  Buffers may be allocated from decoder threads and released from any thread, possibly after the stream that
+   *        allocated them has been destroyed
+   */
+  class IBufferAllocator
+  {
+    public:
+      virtual ~IBufferAllocator() = default;
+
+      /**
+       * @brief           Allocate a buffer for frame data
+       * @param size      Minimum size in bytes
+       * @param alignment Required alignment in bytes of the returned pointer
+       * @return          Buffer or null on failure
+       */
+      virtual uint8_t* allocate(const size_t size, const size_t alignment) = 0;
+
+      /**
+       * @brief       Release a buffer once it is no longer referenced by any frame
+       * @param data  A pointer previously returned by allocate()
+       * @param size  The size it was allocated with
+       */
+      virtual void release(uint8_t* data, const size_t size) noexcept = 0;
+  };
+
+  using BufferAllocatorPtr = std::shared_ptr<IBufferAllocator>;
+}
+
+#endif // IBUFFERALLOCATOR_H
@@ -34,6 +34,8 @@
 #include <iostream>
 
 #include "types.h"
+#include "ibufferallocator.h"
+#include "framebatch.h"
 #include "imediaframe.h"
 #include "mediapropertyobject.h"
 #include "rational.h"
@@ -42,6 +44,9 @@ namespace media_handling
 {
   /**
    * @brief The "Essence"
+   * @note  With lazyStreamProperties() set, the getters of the properties that need a decoded frame (field order,
+   *        colour space and aspect ratios), and properties(), seek and decode the stream on their first call.
+   *        That call is then not safe alongside another thread reading frames from the stream
    */
   class IMediaStream : public MediaPropertyObject
   {
@@ -71,13 +76,40 @@ namespace media_handling
 
       virtual MediaFramePtr frameByFrameNumber(const int64_t frame_number) = 0;
 
+      /**
+       * @brief           Retrieve the frames of a contiguous range of the stream in one call
+       * @note            Preferable to frameByTimestamp() when every frame is wanted
+       * @param start     Timestamp of the first frame
+       * @param end       Timestamp the range ends before
+       * @param batch     Output frames, in presentation order. Previous contents are replaced
+       * @return          The number of frames retrieved
+       */
+      virtual size_t frames(const int64_t start, const int64_t end, FrameBatch& batch) = 0;
+
+      /**
+       * @brief           Retrieve the next frames of the stream in one call
+       * @param count     Maximum number of frames to retrieve
+       * @param batch     Output frames, in presentation order. Previous contents are replaced
+       * @return          The number of frames retrieved, less than count at the end of the stream
+       */
+      virtual size_t readBatch(const size_t count, FrameBatch& batch) = 0;
+
       /**
        * @brief setFrame    Set the frame-sample for the stream
        * @param sample      Frame sample
        * @return            true==success
+       * @note              The encoder may hold the sample, and read its data, after this returns so the data must
+       *                    not be changed once written
        */
       virtual bool writeFrame(MediaFramePtr sample) = 0;
 
+      /**
+       * @brief   Wait for the frames queued by writeFrame() to be encoded
+       * @note    writeFrame() only queues frames if the sink has MediaProperty::ENCODE_QUEUE_SIZE set
+       * @return  false if a queued frame failed to encode
+       */
+      virtual bool flush() = 0;
+
       /**
        * @brief   Obtain the type of this stream
        * @return  type if known, otherwise UNKNOWN
@@ -124,6 +156,15 @@ namespace media_handling
        * @return  true==success
        */
       virtual bool setInputFormat(const SampleFormat format, std::optional<SampleRate> rate = {}) = 0;
+
+      /**
+       * @brief           Decode and convert frames directly into memory owned by the application
+       * @note            This is for video only. Applies to frames retrieved after this is set. The decoder is
+       *                  restarted with it, so reading resumes from the start of the stream
+       * @param allocator The source of frame buffers. null reverts to the library's own
+       * @return          true==allocator in use
+       */
+      virtual bool setBufferAllocator(BufferAllocatorPtr allocator) = 0;
   };
 
   using MediaStreamPtr = std::shared_ptr<IMediaStream>;
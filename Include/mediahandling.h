@@ -30,6 +30,7 @@
 
 #include <atomic>
 
+#include "executor.h"
 #include "imediasource.h"
 #include "imediasink.h"
 #include "rational.h"
@@ -46,6 +47,8 @@ namespace media_handling
   namespace global
   {
     extern std::atomic<bool> auto_detect_img_sequence;
+    extern std::atomic<bool> lazy_stream_properties;
+    extern std::atomic<int32_t> decode_thread_budget;
   }
 
   namespace utils
@@ -78,11 +81,14 @@ namespace media_handling
   };
 
   /**
-   * @brief Initialise the library with a selected backend
-   * @note  This does nothing as only FFMpeg is available
-   * @return true==initialised ok
+   * @brief                 Initialise the library with a selected backend
+   * @note                  Only FFMpeg is available
+   * @param backend         The backend
+   * @param worker_threads  Number of threads of the worker pool shared by the library. 0 for a thread per core
+   * @return                true==initialised ok
+   * @see                   Executor
    */
-  EXPORT bool initialise(const BackendType backend);
+  EXPORT bool initialise(const BackendType backend, const size_t worker_threads = 0);
 
   /**
    * @brief           Enable/disable printing of the backend library messages to console
@@ -125,6 +131,32 @@ namespace media_handling
    * @return true==auto-detecting
    */
   EXPORT bool autoDetectImageSequences() noexcept;
+
+  /**
+   * @brief Globally set opening of sources without decoding. Stream properties that require a decoded frame
+   *        (field order, colour space and aspect ratios) are then found on first access instead
+   * @param value true==lazy
+   */
+  EXPORT void lazyStreamProperties(const bool value) noexcept;
+
+  /**
+   * @brief Obtain the global setting for lazily finding stream properties
+   * @return true==lazy
+   */
+  EXPORT bool lazyStreamProperties() noexcept;
+
+  /**
+   * @brief       Globally limit the threads used for decoding, shared between all the open streams that do not have
+   *              their THREADS property set. Streams already open take on their new share when they next seek
+   * @param value The total number of decode threads. 0 for no limit, where every stream uses a thread per core
+   */
+  EXPORT void decodeThreadBudget(const int32_t value) noexcept;
+
+  /**
+   * @brief Obtain the global limit of decode threads
+   * @return 0==no limit
+   */
+  EXPORT int32_t decodeThreadBudget() noexcept;
 }
 
 #endif // MEDIAHANDLING_H
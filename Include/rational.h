@@ -32,8 +32,10 @@
 #include <string>
 #include <stdint.h>
 #include <cassert>
+#include <limits>
 #include <stdexcept>
 #include <ostream>
+#include <type_traits>
 #include <fmt/core.h>
 #include <math.h>
 
@@ -41,18 +43,36 @@ constexpr auto DOUBLE_FUDGER = 1'000'000;
 
 namespace media_handling
 {
+  namespace detail
+  {
+#if defined(__SIZEOF_INT128__)
+    /**
+     * @brief Intermediate type for products of two 64-bit values so that 90kHz+ timebases cannot overflow
+     */
+    __extension__ typedef __int128 rational_wide_t;
+#else
+    // No native 128-bit type (MSVC). Operands are cross-reduced before multiplying, which keeps the common
+    // timebase cases in range, but products of two large co-prime values can still overflow
+    typedef int64_t rational_wide_t;
+#endif
+  }
+
   //TODO: perhaps template the types of numerator + denominator
+  /**
+   * @brief A constexpr value type holding a reduced fraction
+   * @note  The denominator is always kept positive so that the sign is held by the numerator
+   */
   class EXPORT Rational
   {
     public:
-      Rational() = default;
-      explicit Rational(const int64_t num)
+      constexpr Rational() = default;
+      constexpr explicit Rational(const int64_t num)
         : numerator_(num),
           denominator_(1LL)
       {
 
       }
-      explicit Rational(const int32_t num)
+      constexpr explicit Rational(const int32_t num)
         : numerator_(num),
           denominator_(1LL)
       {
@@ -64,27 +84,26 @@ namespace media_handling
         // FIXME: this is poor. do this properly
       }
 
-      Rational(const int64_t num, const int64_t denom)
+      constexpr Rational(const int64_t num, const int64_t denom)
         : numerator_(num), denominator_(denom)
       {
         if (denom == 0LL) {
           throw std::runtime_error("Denominator of Rational is zero");
         }
-        const auto div = gcd();
+        if (denominator_ < 0LL) {
+          numerator_ = -numerator_;
+          denominator_ = -denominator_;
+        }
+        const auto div = gcd(numerator_, denominator_);
         if (div > 1LL) {
           numerator_ /= div;
           denominator_ /= div;
         }
       }
 
-      Rational& operator=(const Rational& rhs) noexcept
-      {
-        if (this != &rhs) {
-          numerator_ = rhs.numerator_;
-          denominator_ = rhs.denominator_;
-        }
-        return *this;
-      }
+      constexpr Rational(const Rational& rhs) = default;
+      constexpr Rational& operator=(const Rational& rhs) = default;
+
       template<typename T>
       Rational& operator=(const T value) noexcept
       {
@@ -95,29 +114,24 @@ namespace media_handling
       }
 
     public:
-      operator double() const noexcept
+      constexpr operator double() const noexcept
       {
         return toDouble();
       }
 
-      operator int32_t() const noexcept
+      constexpr operator int32_t() const noexcept
       {
-        return static_cast<int32_t>(lround(toDouble()));
+        return static_cast<int32_t>(rounded());
       }
 
-      operator int64_t() const noexcept
+      constexpr operator int64_t() const noexcept
       {
-        return static_cast<int64_t>(llround(toDouble()));
+        return rounded();
       }
 
-      Rational& operator*=(const Rational& rhs) noexcept
+      constexpr Rational& operator*=(const Rational& rhs) noexcept
       {
         *this = *this * rhs;
-        const auto div = gcd();
-        if (div > 1LL) {
-          numerator_ /= div;
-          denominator_ /= div;
-        }
         return *this;
       }
 
@@ -127,14 +141,9 @@ namespace media_handling
         return operator*=(Rational(rhs));
       }
 
-      Rational& operator/=(const Rational& rhs) noexcept
+      constexpr Rational& operator/=(const Rational& rhs) noexcept
       {
         *this = *this / rhs;
-        const auto div = gcd();
-        if (div > 1) {
-          numerator_ /= div;
-          denominator_ /= div;
-        }
         return *this;
       }
 
@@ -143,56 +152,73 @@ namespace media_handling
       {
         return operator/=(Rational(rhs));
       }
-      template<typename T>
-      constexpr bool operator>=(const T& val) const noexcept
+
+      constexpr Rational& operator+=(const Rational& rhs) noexcept
       {
-        return toDouble() >= val;
+        *this = *this + rhs;
+        return *this;
       }
+
       template<typename T>
-      constexpr bool operator>(const T& val) const noexcept
+      Rational& operator+=(const T rhs) noexcept
       {
-        return toDouble() > val;
+        return operator+=(Rational(rhs));
       }
-      template<typename T>
-      constexpr bool operator<=(const T& val) const noexcept
+
+      constexpr Rational& operator-=(const Rational& rhs) noexcept
       {
-        return toDouble() <= val;
+        *this = *this - rhs;
+        return *this;
       }
+
       template<typename T>
-      constexpr bool operator<(const T& val) const noexcept
+      Rational& operator-=(const T rhs) noexcept
       {
-        return toDouble() < val;
+        return operator-=(Rational(rhs));
       }
 
-      bool operator>(const Rational& rhs) const noexcept
+      constexpr Rational operator-() const noexcept
+      {
+        return fromReduced(-numerator_, denominator_);
+      }
+
+      constexpr bool operator>(const Rational& rhs) const noexcept
+      {
+        return compare(*this, rhs) > 0;
+      }
+      constexpr bool operator<(const Rational& rhs) const noexcept
       {
-        const auto a = numerator_ * rhs.denominator_;
-        const auto b = rhs.numerator_ * denominator_;
-        return a > b;
+        return compare(*this, rhs) < 0;
       }
-      bool operator<(const Rational& rhs) const noexcept
+      constexpr bool operator>=(const Rational& rhs) const noexcept
       {
-        const auto a = numerator_ * rhs.denominator_;
-        const auto b = rhs.numerator_ * denominator_;
-        return a < b;
+        return compare(*this, rhs) >= 0;
       }
-      bool operator==(const Rational& rhs) const noexcept
+      constexpr bool operator<=(const Rational& rhs) const noexcept
       {
+        return compare(*this, rhs) <= 0;
+      }
+      constexpr bool operator==(const Rational& rhs) const noexcept
+      {
+        // Both sides are always reduced so the representation is unique
         return (numerator_ == rhs.numerator_) && (denominator_ == rhs.denominator_);
       }
-      bool operator!=(const Rational& rhs) const noexcept
+      constexpr bool operator!=(const Rational& rhs) const noexcept
       {
         return !operator==(rhs);
       }
 
-      Rational invert() const noexcept
+      constexpr Rational invert() const noexcept
       {
         if (numerator_ == 0LL) {
           return Rational(0);
         }
-        return {denominator_, numerator_};
+        if (numerator_ < 0LL) {
+          return fromReduced(-denominator_, -numerator_);
+        }
+        return fromReduced(denominator_, numerator_);
       }
-      std::string toString()
+      std::string toString() const
       {
         if (denominator_ == 1) {
           return std::to_string(numerator_);
@@ -212,9 +238,14 @@ namespace media_handling
         os << '(' << rhs.numerator() << '/' << rhs.denominator() << ')';
         return os;
       }
-      friend Rational operator*(const Rational& lhs, const Rational& rhs) noexcept
+      friend constexpr Rational operator*(const Rational& lhs, const Rational& rhs) noexcept
       {
-        return {lhs.numerator_ * rhs.numerator_, lhs.denominator_ * rhs.denominator_};
+        // Cross-reduce first so the product is already in lowest terms
+        const auto a = gcd(lhs.numerator_, rhs.denominator_);
+        const auto b = gcd(rhs.numerator_, lhs.denominator_);
+        const auto n = static_cast<wide_t>(lhs.numerator_ / a) * (rhs.numerator_ / b);
+        const auto d = static_cast<wide_t>(lhs.denominator_ / b) * (rhs.denominator_ / a);
+        return fromReduced(narrow(n), narrow(d));
       }
 
       template<typename T>
@@ -227,7 +258,7 @@ namespace media_handling
       {
         return rhs * Rational(value);
       }
-      friend Rational operator/(const Rational& lhs, const Rational& rhs) noexcept
+      friend constexpr Rational operator/(const Rational& lhs, const Rational& rhs) noexcept
       {
         return lhs * rhs.invert();
       }
@@ -241,11 +272,18 @@ namespace media_handling
       {
         return Rational(value) / rhs;
       }
-      friend Rational operator+(const Rational& lhs, const Rational& rhs) noexcept
+      friend constexpr Rational operator+(const Rational& lhs, const Rational& rhs) noexcept
       {
-        const auto n = (lhs.numerator_ * rhs.denominator_) + (rhs.numerator_ * lhs.denominator_);
-        const auto d = lhs.denominator_ * rhs.denominator_;
-        return {n, d};
+        // Knuth, TAOCP vol.2 4.5.1: only the gcd of the denominators can be shared with the new numerator
+        const auto div = gcd(lhs.denominator_, rhs.denominator_);
+        const auto t = static_cast<wide_t>(lhs.numerator_) * (rhs.denominator_ / div)
+                       + static_cast<wide_t>(rhs.numerator_) * (lhs.denominator_ / div);
+        if (div == 1LL) {
+          return fromReduced(narrow(t), narrow(static_cast<wide_t>(lhs.denominator_) * rhs.denominator_));
+        }
+        const auto div2 = gcd(static_cast<int64_t>(t % div), div);
+        return fromReduced(narrow(t / div2),
+                           narrow(static_cast<wide_t>(lhs.denominator_ / div) * (rhs.denominator_ / div2)));
       }
       template<typename T>
       friend Rational operator+(const Rational& lhs, const T value) noexcept
@@ -257,11 +295,9 @@ namespace media_handling
       {
         return Rational(value) + rhs;
       }
-      friend Rational operator-(const Rational& lhs, const Rational& rhs) noexcept
+      friend constexpr Rational operator-(const Rational& lhs, const Rational& rhs) noexcept
       {
-        const auto n = (lhs.numerator_ * rhs.denominator_) - (rhs.numerator_ * lhs.denominator_);
-        const auto d = lhs.denominator_ * rhs.denominator_;
-        return {n, d};
+        return lhs + (-rhs);
       }
       template<typename T>
       friend Rational operator-(const Rational& lhs, const T value) noexcept
@@ -274,14 +310,40 @@ namespace media_handling
         return Rational(value) - rhs;
       }
       template<typename T>
-      friend bool operator>(const Rational& lhs, const T value) noexcept
+      friend constexpr bool operator>(const Rational& lhs, const T value) noexcept
+      {
+        if constexpr (std::is_floating_point_v<T>) {
+          return lhs.toDouble() > value;
+        } else {
+          return lhs > Rational(value);
+        }
+      }
+      template<typename T>
+      friend constexpr bool operator<(const Rational& lhs, const T value) noexcept
       {
-        return lhs > Rational(value);
+        if constexpr (std::is_floating_point_v<T>) {
+          return lhs.toDouble() < value;
+        } else {
+          return lhs < Rational(value);
+        }
       }
       template<typename T>
-      friend bool operator<(const Rational& lhs, const T value) noexcept
+      friend constexpr bool operator>=(const Rational& lhs, const T value) noexcept
       {
-        return lhs < Rational(value);
+        if constexpr (std::is_floating_point_v<T>) {
+          return lhs.toDouble() >= value;
+        } else {
+          return lhs >= Rational(value);
+        }
+      }
+      template<typename T>
+      friend constexpr bool operator<=(const Rational& lhs, const T value) noexcept
+      {
+        if constexpr (std::is_floating_point_v<T>) {
+          return lhs.toDouble() <= value;
+        } else {
+          return lhs <= Rational(value);
+        }
       }
       template<typename T>
       friend bool operator==(const Rational& lhs, const T value) noexcept
@@ -295,17 +357,67 @@ namespace media_handling
       }
 
     private:
+      using wide_t = detail::rational_wide_t;
       int64_t numerator_ {0};
       int64_t denominator_ {0};
-      int64_t gcd ()
+
+      /**
+       * @brief Euclid's algorithm on the magnitudes of a and b
+       * @note  Never returns 0 so the result is always safe to divide by
+       */
+      static constexpr int64_t gcd(const int64_t a, const int64_t b) noexcept
+      {
+        auto x = a < 0 ? 0ULL - static_cast<uint64_t>(a) : static_cast<uint64_t>(a);
+        auto y = b < 0 ? 0ULL - static_cast<uint64_t>(b) : static_cast<uint64_t>(b);
+        while (y != 0ULL) {
+          const auto r = x % y;
+          x = y;
+          y = r;
+        }
+        return x == 0ULL ? 1LL : static_cast<int64_t>(x);
+      }
+
+      static constexpr int64_t narrow(const wide_t value) noexcept
+      {
+        assert((value <= std::numeric_limits<int64_t>::max()) && (value >= std::numeric_limits<int64_t>::min()));
+        return static_cast<int64_t>(value);
+      }
+
+      /**
+       * @brief Build from a numerator/denominator pair that is already in lowest terms with a positive denominator
+       */
+      static constexpr Rational fromReduced(const int64_t num, const int64_t denom) noexcept
       {
-        // FIXME: brute forced
-        for (auto i = denominator_; i > 0; --i) {
-          if ( ((numerator_ % i) == 0) && ((denominator_ % i) == 0) ) {
-            return i;
-          }
+        Rational val;
+        val.numerator_ = num;
+        val.denominator_ = denom;
+        return val;
+      }
+
+      /**
+       * @brief Exact three-way comparison
+       * @return <0, 0 or >0
+       */
+      static constexpr int compare(const Rational& lhs, const Rational& rhs) noexcept
+      {
+        const auto a = static_cast<wide_t>(lhs.numerator_) * rhs.denominator_;
+        const auto b = static_cast<wide_t>(rhs.numerator_) * lhs.denominator_;
+        return (a > b) - (a < b);
+      }
+
+      /**
+       * @brief Round to the nearest integer, halfway cases away from zero (as llround)
+       */
+      constexpr int64_t rounded() const noexcept
+      {
+        assert(denominator_ != 0);
+        const auto quot = numerator_ / denominator_;
+        const auto rem = numerator_ % denominator_;
+        const auto twice = static_cast<wide_t>(rem < 0 ? -rem : rem) * 2;
+        if (twice >= denominator_) {
+          return numerator_ < 0 ? quot - 1 : quot + 1;
         }
-        return 1;
+        return quot;
       }
   };
 }
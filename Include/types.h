@@ -91,6 +91,8 @@ namespace media_handling
     START_TIMECODE,       // Timecode
     PICTURE_TYPE,          // PictureType
     OPERATIONAL_PATTERN,  // OperationalPattern
+    THREAD_TYPE,          // ThreadType
+    ENCODE_QUEUE_SIZE,    // int32_t frames queued per stream of a sink, which then encodes and muxes asynchronously
   };
 
   enum class OperationalPattern 
@@ -185,6 +187,13 @@ namespace media_handling
     UNKNOWN
   };
 
+  enum class ThreadType
+  {
+    AUTO,   // Chosen by the codec
+    FRAME,  // Several frames decoded at once. Higher throughput but adds a frame of latency per thread
+    SLICE   // Slices of a frame decoded at once. No latency but not all codecs/streams have slices
+  };
+
   enum class FieldOrder
   {
     PROGRESSIVE,
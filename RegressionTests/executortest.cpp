@@ -0,0 +1,139 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <vector>
+
+#include "executor.h"
+
+using namespace media_handling;
+
+TEST (ExecutorTest, Workers)
+{
+  Executor executor(3);
+  ASSERT_EQ(executor.workers(), 3);
+  ASSERT_EQ(executor.pending(), 0);
+  Executor automatic(0);
+  ASSERT_TRUE(automatic.workers() > 0);
+}
+
+TEST (ExecutorTest, Submit)
+{
+  std::atomic<int> count {0};
+  {
+    Executor executor(4);
+    for (auto ix = 0; ix < 1000; ++ix) {
+      executor.submit([&count] { ++count; });
+    }
+  }
+  // Queued tasks are run before destruction completes
+  ASSERT_EQ(count, 1000);
+}
+
+TEST (ExecutorTest, SubmitIntrospection)
+{
+  Executor executor(1);
+  std::promise<void> release;
+  std::promise<void> started;
+  auto blocker = release.get_future().share();
+  executor.submit([blocker, &started] { started.set_value(); blocker.wait(); });
+  // Otherwise the worker could take the tasks below first, as it runs the newest of its own queue first
+  started.get_future().wait();
+  std::atomic<int> count {0};
+  for (auto ix = 0; ix < 10; ++ix) {
+    executor.submit([&count] { ++count; });
+  }
+  // The only worker is held so the others stay queued
+  ASSERT_EQ(executor.pending(), 10);
+  release.set_value();
+  while (executor.completed() < 11) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(count, 10);
+  ASSERT_EQ(executor.pending(), 0);
+}
+
+TEST (ExecutorTest, ParallelFor)
+{
+  Executor executor(4);
+  std::vector<int> visits(10000, 0);
+  executor.parallelFor(visits.size(), [&visits] (const size_t index) { ++visits[index]; });
+  for (const auto visit : visits) {
+    ASSERT_EQ(visit, 1);
+  }
+}
+
+TEST (ExecutorTest, NestedParallelFor)
+{
+  // Callers run the indices themselves so nesting cannot deadlock, even with a single worker
+  Executor executor(1);
+  std::atomic<int> count {0};
+  std::promise<void> done;
+  executor.submit([&] {
+    executor.parallelFor(8, [&] (const size_t) {
+      executor.parallelFor(8, [&count] (const size_t) { ++count; });
+    });
+    done.set_value();
+  });
+  done.get_future().wait();
+  ASSERT_EQ(count, 64);
+}
+
+TEST (ExecutorTest, ParallelForRunsOnlyItsOwnIndices)
+{
+  std::atomic<bool> other_ran {false};
+  Executor executor(1);
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> started;
+  executor.submit([released, &started] { started.set_value(); released.wait(); });
+  started.get_future().wait();
+  executor.submit([&other_ran] { other_ran = true; });
+  // The worker is busy, so the caller runs every index. It must not run the unrelated task whilst doing so
+  std::atomic<int> count {0};
+  executor.parallelFor(8, [&count] (const size_t) { ++count; });
+  ASSERT_EQ(count, 8);
+  ASSERT_FALSE(other_ran);
+  release.set_value();
+}
+
+TEST (ExecutorTest, Configure)
+{
+  Executor::configure(2);
+  auto executor = Executor::global();
+  ASSERT_TRUE(executor);
+  ASSERT_EQ(executor->workers(), 2);
+  Executor::configure(0);
+  ASSERT_NE(Executor::global(), executor);
+  // The previous executor remains usable by those holding it
+  std::atomic<int> count {0};
+  executor->parallelFor(4, [&count] (const size_t) { ++count; });
+  ASSERT_EQ(count, 4);
+}
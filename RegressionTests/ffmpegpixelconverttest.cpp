@@ -0,0 +1,194 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "ffmpegpixelconvert.h"
+#include "ffmpegtypes.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+using namespace media_handling::ffmpeg;
+
+namespace
+{
+  const std::vector<AVPixelFormat> SOURCES {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUV422P,
+        AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_YUV422P10LE};
+  const std::vector<AVPixelFormat> OUTPUTS {AV_PIX_FMT_RGBA, AV_PIX_FMT_RGB24};
+
+  types::AVFrameUPtr makeFrame(const AVPixelFormat format, const int width, const int height)
+  {
+    types::AVFrameUPtr frame(av_frame_alloc());
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    EXPECT_EQ(av_frame_get_buffer(frame.get(), 0), 0);
+    return frame;
+  }
+
+  /**
+   * @brief Fill each plane of a YUV frame with samples from a function of their position
+   */
+  template <typename Func>
+  void fill(AVFrame& frame, Func&& sample)
+  {
+    const auto desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame.format));
+    ASSERT_TRUE(desc != nullptr);
+    const auto depth = desc->comp[0].depth;
+    for (auto plane = 0; plane < 3; ++plane) {
+      const auto width = plane == 0 ? frame.width : AV_CEIL_RSHIFT(frame.width, desc->log2_chroma_w);
+      const auto height = plane == 0 ? frame.height : AV_CEIL_RSHIFT(frame.height, desc->log2_chroma_h);
+      for (auto y = 0; y < height; ++y) {
+        uint8_t* row = frame.data[plane] + static_cast<ptrdiff_t>(y) * frame.linesize[plane];
+        for (auto x = 0; x < width; ++x) {
+          const auto value = sample(plane, x, y) & ((1 << depth) - 1);
+          if (depth > 8) {
+            reinterpret_cast<uint16_t*>(row)[x] = static_cast<uint16_t>(value);
+          } else {
+            row[x] = static_cast<uint8_t>(value);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief The largest difference between two frames' channels
+   */
+  int maxDifference(const AVFrame& lhs, const AVFrame& rhs, const int channels)
+  {
+    int diff = 0;
+    for (auto y = 0; y < lhs.height; ++y) {
+      const uint8_t* left = lhs.data[0] + static_cast<ptrdiff_t>(y) * lhs.linesize[0];
+      const uint8_t* right = rhs.data[0] + static_cast<ptrdiff_t>(y) * rhs.linesize[0];
+      for (auto x = 0; x < (lhs.width * channels); ++x) {
+        diff = std::max(diff, std::abs(left[x] - right[x]));
+      }
+    }
+    return diff;
+  }
+}
+
+TEST (FFMpegPixelConversionTest, Supported)
+{
+  for (const auto src : SOURCES) {
+    for (const auto dst : OUTPUTS) {
+      const auto conversion = FFMpegPixelConversion::find(src, dst);
+      ASSERT_TRUE(conversion);
+      ASSERT_EQ(conversion->source(), src);
+      ASSERT_EQ(conversion->destination(), dst);
+      ASSERT_EQ(conversion->level(), detectSimdLevel());
+    }
+  }
+  ASSERT_FALSE(FFMpegPixelConversion::find(AV_PIX_FMT_YUV444P, AV_PIX_FMT_RGBA));
+  ASSERT_FALSE(FFMpegPixelConversion::find(AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGB48LE));
+}
+
+TEST (FFMpegPixelConversionTest, LevelLimitedToCpu)
+{
+  const auto conversion = FFMpegPixelConversion::find(AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA, SimdLevel::AVX512);
+  ASSERT_TRUE(conversion);
+  ASSERT_TRUE(conversion->level() <= detectSimdLevel());
+  const auto scalar = FFMpegPixelConversion::find(AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA, SimdLevel::SCALAR);
+  ASSERT_TRUE(scalar);
+  ASSERT_EQ(scalar->level(), SimdLevel::SCALAR);
+}
+
+TEST (FFMpegPixelConversionTest, FormatMismatchRejected)
+{
+  const auto conversion = FFMpegPixelConversion::find(AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA);
+  ASSERT_TRUE(conversion);
+  auto src = makeFrame(AV_PIX_FMT_YUV422P, 64, 64);
+  auto dst = makeFrame(AV_PIX_FMT_RGBA, 64, 64);
+  ASSERT_FALSE(conversion->convert(*src, *dst));
+  src = makeFrame(AV_PIX_FMT_YUV420P, 64, 32);
+  ASSERT_FALSE(conversion->convert(*src, *dst));
+}
+
+TEST (FFMpegPixelConversionTest, VectorisedMatchesScalar)
+{
+  std::mt19937 rng(20);
+  // Widths that leave a tail for each vector width
+  for (const auto width : {1, 3, 17, 62, 131, 1921}) {
+    for (const auto src_fmt : SOURCES) {
+      auto src = makeFrame(src_fmt, width, 9);
+      fill(*src, [&rng] (int, int, int) { return static_cast<int>(rng()); });
+      for (const auto dst_fmt : OUTPUTS) {
+        const auto scalar = FFMpegPixelConversion::find(src_fmt, dst_fmt, SimdLevel::SCALAR);
+        auto expected = makeFrame(dst_fmt, width, 9);
+        ASSERT_TRUE(scalar->convert(*src, *expected));
+        for (const auto level : {SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512}) {
+          const auto conversion = FFMpegPixelConversion::find(src_fmt, dst_fmt, level);
+          auto actual = makeFrame(dst_fmt, width, 9);
+          ASSERT_TRUE(conversion->convert(*src, *actual));
+          ASSERT_EQ(maxDifference(*expected, *actual, dst_fmt == AV_PIX_FMT_RGBA ? 4 : 3), 0)
+              << av_get_pix_fmt_name(src_fmt) << " -> " << av_get_pix_fmt_name(dst_fmt) << " level "
+              << static_cast<int>(conversion->level()) << " width " << width;
+        }
+      }
+    }
+  }
+}
+
+TEST (FFMpegPixelConversionTest, MatchesSwscale)
+{
+  constexpr auto WIDTH = 1280;
+  constexpr auto HEIGHT = 720;
+  for (const auto src_fmt : SOURCES) {
+    auto src = makeFrame(src_fmt, WIDTH, HEIGHT);
+    // Smooth gradients, as swscale interpolates chroma where these conversions take the nearest sample
+    const auto shift = av_pix_fmt_desc_get(src_fmt)->comp[0].depth - 8;
+    fill(*src, [shift] (const int plane, const int x, const int y) {
+      switch (plane) {
+        case 0:
+          return (16 + ((x + y) * 219) / (WIDTH + HEIGHT)) << shift;
+        case 1:
+          return (16 + (x * 224) / WIDTH) << shift;
+        default:
+          return (240 - (y * 224) / HEIGHT) << shift;
+      }
+    });
+    for (const auto dst_fmt : OUTPUTS) {
+      types::SWSContextUPtr sws(sws_getContext(WIDTH, HEIGHT, src_fmt, WIDTH, HEIGHT, dst_fmt, SWS_BICUBIC,
+                                               nullptr, nullptr, nullptr));
+      ASSERT_TRUE(sws);
+      auto expected = makeFrame(dst_fmt, WIDTH, HEIGHT);
+      sws_scale(sws.get(), src->data, src->linesize, 0, HEIGHT, expected->data, expected->linesize);
+      const auto conversion = FFMpegPixelConversion::find(src_fmt, dst_fmt);
+      auto actual = makeFrame(dst_fmt, WIDTH, HEIGHT);
+      ASSERT_TRUE(conversion->convert(*src, *actual));
+      ASSERT_LE(maxDifference(*expected, *actual, dst_fmt == AV_PIX_FMT_RGBA ? 4 : 3), 3)
+          << av_get_pix_fmt_name(src_fmt) << " -> " << av_get_pix_fmt_name(dst_fmt);
+    }
+  }
+}
@@ -28,10 +28,14 @@
 
 
 #include <gtest/gtest.h>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <thread>
 
 #include "ffmpegsink.h"
 #include "ffmpegsource.h"
+#include "ffmpegstream.h"
 #include "rational.h"
 #include "mediahandling.h"
 
@@ -449,6 +453,240 @@ TEST(FFMpegSinkTest, WriteH264)
   ASSERT_EQ(bitrate/1'000'000, 10);
 }
 
+TEST(FFMpegSinkTest, WriteH264ConvertedInput)
+{
+  FFMpegSource source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
+  auto source_v_stream = source.visualStream(0);
+  ASSERT_TRUE(source_v_stream != nullptr);
+  ASSERT_TRUE(source_v_stream->setOutputFormat(PixelFormat::RGB24, {1280, 720}));
+  FFMpegSink sink("/tmp/h264_rgb.mp4", {Codec::H264}, {});
+  ASSERT_TRUE(sink.initialise());
+  auto stream = sink.visualStream(0);
+  stream->setProperty(MediaProperty::FRAME_RATE, Rational(25));
+  stream->setProperty(MediaProperty::DIMENSIONS, Dimensions({1280,720}));
+  stream->setProperty(MediaProperty::COMPRESSION, CompressionStrategy::TARGETBITRATE);
+  stream->setProperty(MediaProperty::BITRATE, 10'000'000);
+  stream->setProperty(MediaProperty::PRESET, Preset::X264_FAST);
+  // Not an encoder format, so converted in writeFrame()
+  ASSERT_TRUE(stream->setInputFormat(PixelFormat::RGB24));
+
+  auto count = 0;
+  while (auto frame = source_v_stream->frame()) {
+    ASSERT_TRUE(stream->writeFrame(frame));
+    ++count;
+  }
+  ASSERT_TRUE(count > 0);
+  ASSERT_TRUE(stream->writeFrame(nullptr));
+  sink.finish();
+
+  FFMpegSource written_file("/tmp/h264_rgb.mp4");
+  ASSERT_TRUE(written_file.visualStreams().size() == 1);
+  auto v_s = written_file.visualStream(0);
+  bool okay;
+  auto dims = v_s->property<Dimensions>(MediaProperty::DIMENSIONS, okay);
+  ASSERT_TRUE(okay);
+  ASSERT_EQ(dims.width, 1280);
+  ASSERT_EQ(dims.height, 720);
+  auto pix_fmt = v_s->property<PixelFormat>(MediaProperty::PIXEL_FORMAT, okay);
+  ASSERT_TRUE(okay);
+  ASSERT_EQ(pix_fmt, PixelFormat::YUV420);
+  auto written = 0;
+  while (v_s->frame()) {
+    ++written;
+  }
+  ASSERT_EQ(written, count);
+}
+
+TEST(FFMpegSinkTest, WriteH264Asynchronous)
+{
+  FFMpegSource source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
+  auto source_v_stream = source.visualStream(0);
+  ASSERT_TRUE(source_v_stream != nullptr);
+  ASSERT_TRUE(source_v_stream->setOutputFormat(PixelFormat::YUV420, {1280, 720}));
+  FFMpegSink sink("/tmp/h264_async.mp4", {Codec::H264}, {});
+  sink.setProperty(MediaProperty::ENCODE_QUEUE_SIZE, 4);
+  ASSERT_TRUE(sink.initialise());
+  auto stream = sink.visualStream(0);
+  stream->setProperty(MediaProperty::FRAME_RATE, Rational(25));
+  stream->setProperty(MediaProperty::DIMENSIONS, Dimensions({1280,720}));
+  stream->setProperty(MediaProperty::COMPRESSION, CompressionStrategy::TARGETBITRATE);
+  stream->setProperty(MediaProperty::BITRATE, 10'000'000);
+  stream->setProperty(MediaProperty::PRESET, Preset::X264_FAST);
+  ASSERT_TRUE(stream->setInputFormat(PixelFormat::YUV420));
+
+  auto count = 0;
+  while (auto frame = source_v_stream->frame()) {
+    ASSERT_TRUE(stream->writeFrame(frame));
+    ++count;
+  }
+  ASSERT_TRUE(count > 0);
+  ASSERT_TRUE(stream->writeFrame(nullptr));
+  ASSERT_TRUE(stream->flush());
+  ASSERT_TRUE(sink.flush());
+  sink.finish();
+
+  FFMpegSource written_file("/tmp/h264_async.mp4");
+  ASSERT_TRUE(written_file.visualStreams().size() == 1);
+  auto v_s = written_file.visualStream(0);
+  auto written = 0;
+  while (v_s->frame()) {
+    ++written;
+  }
+  ASSERT_EQ(written, count);
+}
+
+TEST(FFMpegSinkTest, WriteH264ReferencedFrames)
+{
+  FFMpegSource source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
+  auto source_v_stream = source.visualStream(0);
+  ASSERT_TRUE(source_v_stream != nullptr);
+  ASSERT_TRUE(source_v_stream->setOutputFormat(PixelFormat::YUV420, {1280, 720}));
+  FFMpegSink sink("/tmp/h264_referenced.mp4", {Codec::H264}, {});
+  ASSERT_TRUE(sink.initialise());
+  auto stream = sink.visualStream(0);
+  stream->setProperty(MediaProperty::FRAME_RATE, Rational(25));
+  stream->setProperty(MediaProperty::DIMENSIONS, Dimensions({1280,720}));
+  stream->setProperty(MediaProperty::COMPRESSION, CompressionStrategy::TARGETBITRATE);
+  stream->setProperty(MediaProperty::BITRATE, 10'000'000);
+  stream->setProperty(MediaProperty::PRESET, Preset::X264_FAST);
+  ASSERT_TRUE(stream->setInputFormat(PixelFormat::YUV420));
+
+  // The encoder shares the written frames' buffers instead of copying them, and releases them once finished
+  std::vector<std::weak_ptr<IMediaFrame>> frames;
+  while (auto frame = source_v_stream->frame()) {
+    ASSERT_TRUE(stream->writeFrame(frame));
+    frames.emplace_back(frame);
+  }
+  ASSERT_FALSE(frames.empty());
+  ASSERT_TRUE(stream->writeFrame(nullptr));
+  sink.finish();
+  for (const auto& frame : frames) {
+    ASSERT_TRUE(frame.expired());
+  }
+
+  FFMpegSource written_file("/tmp/h264_referenced.mp4");
+  ASSERT_TRUE(written_file.visualStreams().size() == 1);
+  auto v_s = written_file.visualStream(0);
+  size_t written = 0;
+  while (v_s->frame()) {
+    ++written;
+  }
+  ASSERT_EQ(written, frames.size());
+}
+
+TEST(FFMpegSinkTest, WriteH264RecycledFrames)
+{
+  FFMpegSource source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
+  auto source_v_stream = source.visualStream(0);
+  ASSERT_TRUE(source_v_stream != nullptr);
+  ASSERT_TRUE(source_v_stream->setOutputFormat(PixelFormat::YUV420, {1280, 720}));
+  FFMpegSink sink("/tmp/h264_recycled.mp4", {Codec::H264}, {});
+  ASSERT_TRUE(sink.initialise());
+  auto stream = sink.visualStream(0);
+  stream->setProperty(MediaProperty::FRAME_RATE, Rational(25));
+  stream->setProperty(MediaProperty::DIMENSIONS, Dimensions({1280,720}));
+  stream->setProperty(MediaProperty::COMPRESSION, CompressionStrategy::TARGETBITRATE);
+  stream->setProperty(MediaProperty::BITRATE, 10'000'000);
+  stream->setProperty(MediaProperty::PRESET, Preset::X264_FAST);
+  ASSERT_TRUE(stream->setInputFormat(PixelFormat::YUV420));
+
+  FrameBatch batch;
+  ASSERT_EQ(source_v_stream->readBatch(1, batch), 1);
+  const auto first = batch[0].get();
+  const auto written = batch[0]->data();
+  ASSERT_TRUE(written.data_ != nullptr);
+  const uint8_t* plane = written.data_[0];
+  const std::vector<uint8_t> row(plane, plane + written.line_size_);
+  ASSERT_TRUE(stream->writeFrame(batch[0]));
+
+  // The slot is reused for the next frame, but the encoder's lookahead still holds the written frame's buffer
+  ASSERT_EQ(source_v_stream->readBatch(1, batch), 1);
+  ASSERT_EQ(batch[0].get(), first);
+  const auto next = batch[0]->data();
+  ASSERT_TRUE(next.data_ != nullptr);
+  ASSERT_NE(next.data_[0], plane);
+  ASSERT_EQ(std::memcmp(plane, row.data(), row.size()), 0);
+
+  auto count = 1;
+  do {
+    ASSERT_TRUE(stream->writeFrame(batch[0]));
+    ++count;
+  } while (source_v_stream->readBatch(1, batch) == 1);
+  ASSERT_TRUE(stream->writeFrame(nullptr));
+  ASSERT_TRUE(stream->flush());
+  sink.finish();
+
+  FFMpegSource written_file("/tmp/h264_recycled.mp4");
+  auto v_s = written_file.visualStream(0);
+  ASSERT_TRUE(v_s != nullptr);
+  auto decoded = 0;
+  while (v_s->frame()) {
+    ++decoded;
+  }
+  ASSERT_EQ(decoded, count);
+}
+
+TEST(FFMpegSinkTest, ConcurrentStreamWrites)
+{
+  FFMpegSource video_source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
+  auto source_v_stream = video_source.visualStream(0);
+  ASSERT_TRUE(source_v_stream != nullptr);
+  ASSERT_TRUE(source_v_stream->setOutputFormat(PixelFormat::YUV420, {1280, 720}));
+  FFMpegSource audio_source("./ReferenceMedia/Audio/ogg/monotone.ogg");
+  auto source_a_stream = audio_source.audioStream(0);
+  ASSERT_TRUE(source_a_stream != nullptr);
+  bool okay;
+  const auto audio_fmt = source_a_stream->property<SampleFormat>(MediaProperty::AUDIO_FORMAT, okay);
+  ASSERT_TRUE(okay);
+
+  FFMpegSink sink("/tmp/concurrent.mp4", {Codec::H264}, {Codec::AAC});
+  ASSERT_TRUE(sink.initialise());
+  auto video = sink.visualStream(0);
+  video->setProperty(MediaProperty::FRAME_RATE, Rational(25));
+  video->setProperty(MediaProperty::DIMENSIONS, Dimensions({1280,720}));
+  video->setProperty(MediaProperty::COMPRESSION, CompressionStrategy::TARGETBITRATE);
+  video->setProperty(MediaProperty::BITRATE, 10'000'000);
+  video->setProperty(MediaProperty::PRESET, Preset::X264_FAST);
+  ASSERT_TRUE(video->setInputFormat(PixelFormat::YUV420));
+  auto audio = sink.audioStream(0);
+  audio->setProperty(MediaProperty::BITRATE, 64000);
+  audio->setProperty(MediaProperty::AUDIO_SAMPLING_RATE, 22050);
+  audio->setProperty(MediaProperty::AUDIO_LAYOUT, ChannelLayout::MONO);
+  ASSERT_TRUE(audio->setInputFormat(audio_fmt));
+
+  // Each stream written from a thread of its own, into the one container
+  std::atomic<bool> failed {false};
+  std::atomic<int> video_frames {0};
+  std::thread video_writer([&] {
+    while (auto frame = source_v_stream->frame()) {
+      failed = !video->writeFrame(frame) || failed;
+      ++video_frames;
+    }
+    failed = !video->writeFrame(nullptr) || failed;
+  });
+  std::thread audio_writer([&] {
+    while (auto frame = source_a_stream->frame()) {
+      failed = !audio->writeFrame(frame) || failed;
+    }
+    failed = !audio->writeFrame(nullptr) || failed;
+  });
+  video_writer.join();
+  audio_writer.join();
+  ASSERT_FALSE(failed);
+  ASSERT_TRUE(sink.flush());
+  sink.finish();
+
+  FFMpegSource written_file("/tmp/concurrent.mp4");
+  ASSERT_EQ(written_file.visualStreams().size(), 1);
+  ASSERT_EQ(written_file.audioStreams().size(), 1);
+  auto v_s = written_file.visualStream(0);
+  auto written = 0;
+  while (v_s->frame()) {
+    ++written;
+  }
+  ASSERT_EQ(written, video_frames);
+}
+
 TEST(FFMpegSinkTest, WriteMPEG2)
 {
   FFMpegSource source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
@@ -870,3 +1108,41 @@ TEST(FFMpegSinkTest, StreamPropertiesLocked)
   ASSERT_EQ(layout, ChannelLayout::MONO);
 
 }
+
+TEST(FFMpegSinkTest, RemuxMOVToMXF)
+{
+  FFMpegSource source("./ReferenceMedia/Video/dnxhd/fhd_dnxhd.mov");
+  auto source_v_stream = std::dynamic_pointer_cast<FFMpegStream>(source.visualStream(0));
+  ASSERT_TRUE(source_v_stream != nullptr);
+  FFMpegSink sink("/tmp/dnxhd_copy.mxf", {}, {});
+  ASSERT_TRUE(sink.addCopyStream(*source_v_stream->avStream()));
+  ASSERT_TRUE(sink.initialise());
+  auto stream = std::dynamic_pointer_cast<FFMpegStream>(sink.visualStream(0));
+  ASSERT_TRUE(stream != nullptr);
+  ASSERT_FALSE(stream->writeFrame(nullptr));
+
+  // Packets go from demuxer to muxer without being decoded
+  auto count = 0;
+  while (auto pkt = source_v_stream->readPacket()) {
+    ASSERT_TRUE(stream->copyPacket(*pkt));
+    ++count;
+  }
+  ASSERT_TRUE(count > 0);
+  sink.finish();
+
+  FFMpegSource written_file("/tmp/dnxhd_copy.mxf");
+  ASSERT_TRUE(written_file.visualStreams().size() == 1);
+  auto v_s = written_file.visualStream(0);
+  bool okay;
+  ASSERT_EQ(v_s->property<Codec>(MediaProperty::CODEC, okay), Codec::DNXHD);
+  ASSERT_TRUE(okay);
+  auto dims = v_s->property<Dimensions>(MediaProperty::DIMENSIONS, okay);
+  ASSERT_TRUE(okay);
+  ASSERT_EQ(dims.width, 1920);
+  ASSERT_EQ(dims.height, 1080);
+  auto written = 0;
+  while (v_s->frame()) {
+    ++written;
+  }
+  ASSERT_EQ(written, count);
+}
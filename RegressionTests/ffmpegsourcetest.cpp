@@ -26,6 +26,7 @@
 */
 
 #include <gtest/gtest.h>
+#include <thread>
 
 #include "ffmpegsource.h"
 #include "mediahandling.h"
@@ -347,4 +348,108 @@ TEST (FFMpegSourceTest, StartTimeCodeMxf)
   ASSERT_EQ(start_tc.toString(), "01:00:00:00");
 }
 
+TEST (FFMpegSourceTest, ConcurrentStreamReading)
+{
+  FFMpegSource source("./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4");
+  auto video = source.visualStream(0);
+  auto audio = source.audioStream(0);
+  ASSERT_TRUE(video && audio);
+  auto read_all = [] (MediaStreamPtr stream, int& count) {
+    auto frame = stream->frameByTimestamp(0);
+    while (frame) {
+      ++count;
+      frame = stream->frameByTimestamp();
+    }
+  };
+  int video_frames = 0;
+  int audio_frames = 0;
+  std::thread video_thread(read_all, video, std::ref(video_frames));
+  std::thread audio_thread(read_all, audio, std::ref(audio_frames));
+  video_thread.join();
+  audio_thread.join();
+  ASSERT_TRUE(video_frames > 0);
+  ASSERT_TRUE(audio_frames > 0);
+}
+
+TEST (FFMpegSourceTest, IndependentDemuxerSeek)
+{
+  FFMpegSource source("./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4");
+  auto video = std::dynamic_pointer_cast<FFMpegStream>(source.visualStream(0));
+  auto audio = source.audioStream(0);
+  ASSERT_TRUE(video && audio);
+  ASSERT_TRUE(video->useIndependentDemuxer());
+  bool okay;
+  const auto base = video->property<Rational>(MediaProperty::TIMESCALE, okay);
+  const auto rate = video->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  const int64_t intvl = rate.invert() / base;
+  auto frame = audio->frameByTimestamp(0);
+  ASSERT_TRUE(frame);
+  auto last_audio = frame->timestamp();
+  for (auto ix = 0; ix < 10; ++ix) {
+    // jumping the video around does not disturb the audio
+    ASSERT_TRUE(video->frameByTimestamp(ix % 2 == 0 ? 0 : 30 * intvl));
+    frame = audio->frameByTimestamp();
+    ASSERT_TRUE(frame);
+    ASSERT_TRUE(frame->timestamp() > last_audio);
+    last_audio = frame->timestamp();
+  }
+}
+
+TEST (FFMpegSourceTest, PacketPoolSteadyState)
+{
+  FFMpegSource source("./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4");
+  auto video = source.visualStream(0);
+  ASSERT_TRUE(video);
+  auto frame = video->frameByTimestamp(0);
+  for (auto ix = 0; frame && (ix < 10); ++ix) {
+    frame = video->frameByTimestamp();
+  }
+  ASSERT_TRUE(frame);
+  const auto warm = source.packetPool().allocations();
+  ASSERT_TRUE(warm > 0);
+  for (auto ix = 0; frame && (ix < 30); ++ix) {
+    frame = video->frameByTimestamp();
+  }
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(source.packetPool().allocations(), warm);
+}
+
+TEST (FFMpegSourceTest, LazyStreamProperties)
+{
+  // Restored however the test ends, as the setting is process-wide
+  struct LazyScope
+  {
+      LazyScope() { media_handling::lazyStreamProperties(true); }
+      ~LazyScope() { media_handling::lazyStreamProperties(false); }
+  } lazy;
+  FFMpegSource source("./ReferenceMedia/Video/h265/h265_320_10hr.mov");
+  bool okay;
+  const auto start_tc = source.property<TimeCode>(MediaProperty::START_TIMECODE, okay);
+  ASSERT_TRUE(okay);
+  ASSERT_EQ(start_tc.toString(), "10:00:00:00");
+  ASSERT_EQ(source.property<int32_t>(MediaProperty::VIDEO_STREAMS, okay), 1);
+  auto stream = source.visualStream(0);
+  ASSERT_TRUE(stream);
+  // found on first access
+  stream->property<FieldOrder>(MediaProperty::FIELD_ORDER, okay);
+  ASSERT_TRUE(okay);
+  stream->property<Rational>(MediaProperty::PIXEL_ASPECT_RATIO, okay);
+  ASSERT_TRUE(okay);
+}
 
+TEST (FFMpegSourceTest, StreamsShared)
+{
+  FFMpegSource source("./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4");
+  auto video = source.visualStream(0);
+  ASSERT_TRUE(video);
+  ASSERT_EQ(video, source.visualStream(0));
+  ASSERT_EQ(video, source.visualStreams().at(0));
+  auto audio = source.audioStream(0);
+  ASSERT_TRUE(audio);
+  ASSERT_EQ(audio, source.audioStreams().at(0));
+  ASSERT_NE(video, audio);
+  auto other = source.newVisualStream(0);
+  ASSERT_TRUE(other);
+  ASSERT_NE(video, other);
+  ASSERT_FALSE(source.newVisualStream(1));
+}
@@ -26,6 +26,10 @@
 */
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <set>
 #ifdef PLAY_AUDIO
 #include <ao/ao.h>
 #endif
@@ -360,6 +364,153 @@ TEST (FFMpegStreamTest, SetOutputFormatVideoScaled)
 }
 
 
+TEST (FFMpegStreamTest, BandedConversion)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  const auto convert = [&fname] {
+    auto source = std::make_shared<FFMpegSource>(fname);
+    auto stream = source->visualStream(0);
+    EXPECT_TRUE(stream->setOutputFormat(PixelFormat::RGB24));
+    auto frame = stream->frameByTimestamp(0);
+    EXPECT_TRUE(frame);
+    auto data = frame->data();
+    EXPECT_TRUE(data.data_ != nullptr);
+    std::vector<uint8_t> pixels;
+    for (auto row = 0; row < data.dims_.height; ++row) {
+      const auto start = data.data_[0] + static_cast<ptrdiff_t>(row) * data.line_size_;
+      pixels.insert(pixels.end(), start, start + data.dims_.width * 3);
+    }
+    return pixels;
+  };
+  // A single worker converts whole frames
+  Executor::configure(1);
+  const auto whole = convert();
+  Executor::configure(4);
+  const auto banded = convert();
+  Executor::configure(0);
+  ASSERT_EQ(whole.size(), static_cast<size_t>(1920 * 1080 * 3));
+  ASSERT_TRUE(whole == banded);
+}
+
+TEST (FFMpegStreamTest, BandedConversionScaledWidth)
+{
+  // 4:2:0 chroma is filtered vertically when the width is scaled, which banding would seam at each band's edge
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  const auto convert = [&fname] {
+    auto source = std::make_shared<FFMpegSource>(fname);
+    auto stream = source->visualStream(0);
+    EXPECT_TRUE(stream->setOutputFormat(PixelFormat::RGB24, {1440, 1080}, InterpolationMethod::BILINEAR));
+    auto frame = stream->frameByTimestamp(0);
+    EXPECT_TRUE(frame);
+    auto data = frame->data();
+    EXPECT_TRUE(data.data_ != nullptr);
+    std::vector<uint8_t> pixels;
+    for (auto row = 0; row < data.dims_.height; ++row) {
+      const auto start = data.data_[0] + static_cast<ptrdiff_t>(row) * data.line_size_;
+      pixels.insert(pixels.end(), start, start + data.dims_.width * 3);
+    }
+    return pixels;
+  };
+  Executor::configure(1);
+  const auto whole = convert();
+  Executor::configure(4);
+  const auto banded = convert();
+  Executor::configure(0);
+  ASSERT_EQ(whole.size(), static_cast<size_t>(1440 * 1080 * 3));
+  ASSERT_TRUE(whole == banded);
+}
+
+TEST (FFMpegStreamTest, ConvertedOutputMemoised)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+
+  auto stream = src->visualStream(0);
+  ASSERT_TRUE(stream->setOutputFormat(PixelFormat::RGB24));
+  auto frame = std::dynamic_pointer_cast<FFMpegMediaFrame>(stream->frameByTimestamp(0));
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->conversionCount(), 0);
+  auto data = frame->data();
+  ASSERT_TRUE(data.data_ != nullptr);
+  ASSERT_EQ(frame->data().data_, data.data_);
+  ASSERT_EQ(frame->conversionCount(), 1);
+  frame->invalidate();
+  data = frame->data();
+  ASSERT_TRUE(data.data_ != nullptr);
+  ASSERT_EQ(frame->conversionCount(), 2);
+  ASSERT_TRUE(frame->conversionTime().count() > 0);
+}
+
+TEST (FFMpegStreamTest, FramePoolReuse)
+{
+  FFMpegFramePool pool(AV_PIX_FMT_RGB24, {1920, 1080});
+  for (auto ix = 0; ix < 10; ++ix) {
+    auto frame = pool.acquire();
+    ASSERT_TRUE(frame);
+    ASSERT_EQ(frame->width, 1920);
+    ASSERT_EQ(frame->linesize[0] % 64, 0);
+  }
+  ASSERT_EQ(pool.allocations(), 1);
+  auto first = pool.acquire();
+  auto second = pool.acquire();
+  ASSERT_NE(first->data[0], second->data[0]);
+  ASSERT_EQ(pool.allocations(), 2);
+}
+
+class CountingAllocator : public IBufferAllocator
+{
+  public:
+    uint8_t* allocate(const size_t size, const size_t alignment) override
+    {
+      const auto rounded = ((size + alignment - 1) / alignment) * alignment;
+      auto data = static_cast<uint8_t*>(std::aligned_alloc(alignment, rounded));
+      const std::lock_guard<std::mutex> lock(mutex_);
+      allocated_.insert(data);
+      ++allocations_;
+      return data;
+    }
+    void release(uint8_t* data, const size_t /*size*/) noexcept override
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      allocated_.erase(data);
+      ++releases_;
+      std::free(data);
+    }
+    bool owns(const uint8_t* data) const
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      return std::any_of(allocated_.begin(), allocated_.end(), [data] (const uint8_t* start) {
+        return (data >= start) && (data < start + 64);
+      });
+    }
+    mutable std::mutex mutex_;
+    std::set<uint8_t*> allocated_;
+    int allocations_ {0};
+    int releases_ {0};
+};
+
+TEST (FFMpegStreamTest, BufferAllocatorDecode)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  auto allocator = std::make_shared<CountingAllocator>();
+  {
+    media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+    auto stream = src->visualStream(0);
+    ASSERT_FALSE(src->audioStream(0)->setBufferAllocator(allocator));
+    ASSERT_TRUE(stream->setOutputFormat(PixelFormat::RGB24));
+    ASSERT_TRUE(stream->setBufferAllocator(allocator));
+    for (auto ix = 0; ix < 5; ++ix) {
+      auto frame = stream->frame();
+      ASSERT_TRUE(frame);
+      auto data = frame->data();
+      ASSERT_TRUE(data.data_ != nullptr);
+      ASSERT_TRUE(allocator->owns(data.data_[0]));
+    }
+  }
+  ASSERT_TRUE(allocator->allocations_ > 0);
+  ASSERT_EQ(allocator->allocations_, allocator->releases_);
+}
+
 TEST (FFMpegStreamTest, Openh264FHDAudioStream)
 {
   std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
@@ -672,6 +823,36 @@ INSTANTIATE_TEST_CASE_P(
 
 
 
+TEST (FFMpegStreamTest, LowResolutionDecode)
+{
+  auto source = std::make_unique<FFMpegSource>("./ReferenceMedia/Image/test-002.jpg");
+  auto stream = std::dynamic_pointer_cast<FFMpegStream>(source->visualStream(0));
+  ASSERT_TRUE(stream);
+  stream->setLowResolutionDecode(true);
+  ASSERT_TRUE(stream->setOutputFormat(PixelFormat::RGB24, {200, 133}));
+  ASSERT_EQ(stream->lowResolution(), 2);
+  auto frame = stream->frameByTimestamp(0);
+  ASSERT_TRUE(frame);
+  auto data = frame->data();
+  ASSERT_TRUE(data.data_ != nullptr);
+  ASSERT_EQ(data.dims_.width, 200);
+  ASSERT_EQ(data.dims_.height, 133);
+  // Full size output decodes at full resolution again
+  ASSERT_TRUE(stream->setOutputFormat(PixelFormat::RGB24));
+  ASSERT_EQ(stream->lowResolution(), 0);
+
+  // Decoders without reduced resolution support fall back to downscaling
+  auto video = std::make_unique<FFMpegSource>("./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4");
+  auto video_stream = std::dynamic_pointer_cast<FFMpegStream>(video->visualStream(0));
+  ASSERT_TRUE(video_stream);
+  video_stream->setLowResolutionDecode(true);
+  ASSERT_TRUE(video_stream->setOutputFormat(PixelFormat::RGB24, {480, 270}));
+  ASSERT_EQ(video_stream->lowResolution(), 0);
+  frame = video_stream->frameByTimestamp(0);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->data().dims_.width, 480);
+}
+
 TEST (FFMpegStreamTest, ImageSequenceAuto)
 {
   const auto f_path = "./ReferenceMedia/Image/sequence/im_sequence-0001.dpx";
@@ -808,6 +989,264 @@ TEST (FFMpegStreamTest, IndexedStreamProperties)
   ASSERT_EQ(frame_count, 52);
 }
 
+TEST (FFMpegStreamTest, IndexLeavesOtherStreams)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  std::vector<int64_t> expected;
+  {
+    FFMpegSource reference(fname);
+    auto audio = reference.audioStream(0);
+    ASSERT_TRUE(audio);
+    for (auto ix = 0; ix < 3; ++ix) {
+      auto frame = audio->frame();
+      ASSERT_TRUE(frame);
+      expected.push_back(frame->timestamp());
+    }
+  }
+
+  auto source = std::make_shared<FFMpegSource>(fname);
+  auto video = source->visualStream(0);
+  auto audio = source->audioStream(0);
+  ASSERT_TRUE(video && audio);
+  ASSERT_TRUE(video->index());
+  // Indexing the video did not read the audio's packets, nor move the demuxer they are read from
+  ASSERT_EQ(source->queuedPackets(audio->sourceIndex()), 0);
+  for (const auto timestamp : expected) {
+    auto frame = audio->frame();
+    ASSERT_TRUE(frame);
+    ASSERT_EQ(frame->timestamp(), timestamp);
+  }
+  ASSERT_EQ(source->queuedPackets(audio->sourceIndex()), 0);
+  auto frame = video->frame();
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 0);
+}
+
+TEST (FFMpegStreamTest, IndexedStreamPacketIndex)
+{
+  auto source = std::make_unique<FFMpegSource>("./ReferenceMedia/Video/mxf/mpeg2.mxf");
+  auto stream = std::dynamic_pointer_cast<FFMpegStream>(source->visualStream(0));
+  ASSERT_TRUE(stream);
+  ASSERT_TRUE(stream->packetIndex().empty());
+  ASSERT_TRUE(stream->index());
+  const auto& index = stream->packetIndex();
+  ASSERT_EQ(index.size(), 52);
+  ASSERT_TRUE(index.isKeyframe(0));
+  ASSERT_TRUE(index.totalSize() > 0);
+  const auto key = index.keyframeBefore(index.timestamp(index.size() - 1));
+  ASSERT_TRUE(key.has_value());
+  ASSERT_TRUE(index.isKeyframe(key.value()));
+  // indexing reads with a demuxer of its own, leaving the playhead untouched
+  auto frame = stream->frameByTimestamp();
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 0);
+}
+
+TEST (FFMpegStreamTest, DecoderThreads)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::decodeThreadBudget(4);
+  std::vector<MediaSourcePtr> sources;
+  std::vector<std::shared_ptr<FFMpegStream>> streams;
+  for (auto ix = 0; ix < 4; ++ix) {
+    sources.emplace_back(std::make_shared<FFMpegSource>(fname));
+    streams.emplace_back(std::dynamic_pointer_cast<FFMpegStream>(sources.back()->visualStream(0)));
+    ASSERT_TRUE(streams.back());
+  }
+  ASSERT_EQ(streams.back()->decoderThreads(), 1);
+  bool okay;
+  auto base = streams.front()->property<Rational>(MediaProperty::TIMESCALE, okay);
+  auto rate = streams.front()->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  const int64_t intvl = rate.invert() / base;
+  for (auto& stream : streams) {
+    // Streams opened earlier take on their share of the budget on seeking
+    ASSERT_TRUE(stream->frameByTimestamp(10 * intvl));
+    ASSERT_EQ(stream->decoderThreads(), 1);
+  }
+
+  // The THREADS property takes precedence over the budget
+  streams.front()->setProperty(MediaProperty::THREADS, 2);
+  streams.front()->setProperty(MediaProperty::THREAD_TYPE, ThreadType::SLICE);
+  ASSERT_EQ(streams.front()->decoderThreads(), 2);
+  auto frame = streams.front()->frameByTimestamp(5 * intvl);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 5 * intvl);
+  media_handling::decodeThreadBudget(0);
+}
+
+TEST (FFMpegStreamTest, KeyframesOnly)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  auto source = std::make_unique<FFMpegSource>(fname);
+  auto stream = std::dynamic_pointer_cast<FFMpegStream>(source->visualStream(0));
+  ASSERT_TRUE(stream);
+  ASSERT_FALSE(stream->nearestKeyframe(0).has_value());
+  ASSERT_TRUE(stream->index());
+  const auto& index = stream->packetIndex();
+  const auto last = index.timestamp(index.size() - 1);
+  stream->setKeyframesOnly(true);
+  ASSERT_TRUE(stream->keyframesOnly());
+  for (int64_t ts = 0; ts < last; ts += last / 10) {
+    const auto key = stream->nearestKeyframe(ts);
+    ASSERT_TRUE(key.has_value());
+    auto frame = stream->frameByTimestamp(ts);
+    ASSERT_TRUE(frame);
+    ASSERT_EQ(frame->timestamp(), key.value());
+  }
+  // Sequential reads step from keyframe to keyframe
+  auto first = stream->frameByTimestamp(0);
+  auto second = stream->frameByTimestamp();
+  ASSERT_TRUE(first && second);
+  ASSERT_EQ(second->timestamp(), index.timestamp(index.keyframeAfter(first->timestamp() + 1).value()));
+
+  stream->setKeyframesOnly(false);
+  ASSERT_FALSE(stream->keyframesOnly());
+}
+
+TEST (FFMpegStreamTest, IndexedStreamRandomAccess)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+  auto stream = src->visualStream(0);
+  ASSERT_TRUE(stream);
+  ASSERT_TRUE(stream->index());
+  bool okay;
+  auto base = stream->property<Rational>(MediaProperty::TIMESCALE, okay);
+  ASSERT_TRUE(okay);
+  auto rate = stream->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  ASSERT_TRUE(okay);
+  const int64_t intvl = rate.invert() / base;
+  // forwards, backwards and within the same GOP
+  for (const int64_t frame_number : {25, 3, 40, 41, 10}) {
+    auto frame = stream->frameByTimestamp(frame_number * intvl);
+    ASSERT_TRUE(frame);
+    ASSERT_EQ(frame->timestamp(), frame_number * intvl);
+  }
+}
+
+TEST (FFMpegStreamTest, FrameCacheHits)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+  auto stream = std::dynamic_pointer_cast<FFMpegStream>(src->visualStream(0));
+  ASSERT_TRUE(stream);
+  stream->setFrameCacheBudget(64 * 1024 * 1024);
+  bool okay;
+  auto base = stream->property<Rational>(MediaProperty::TIMESCALE, okay);
+  auto rate = stream->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  const int64_t intvl = rate.invert() / base;
+
+  auto frame = stream->frameByTimestamp(10 * intvl);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(stream->frameCache().hits(), 0);
+  ASSERT_TRUE(stream->frameCache().size() > 0);
+  ASSERT_TRUE(stream->frameCache().bytes() <= stream->frameCache().budget());
+  frame = stream->frameByTimestamp(10 * intvl);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 10 * intvl);
+  ASSERT_EQ(stream->frameCache().hits(), 1);
+  // sequential reads continue from the cached frame
+  frame = stream->frameByTimestamp();
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 11 * intvl);
+
+  stream->setFrameCacheBudget(0);
+  ASSERT_EQ(stream->frameCache().size(), 0);
+}
+
+TEST (FFMpegStreamTest, ReadAheadSequential)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+  auto stream = std::dynamic_pointer_cast<FFMpegStream>(src->visualStream(0));
+  ASSERT_TRUE(stream);
+  ASSERT_TRUE(stream->setOutputFormat(PixelFormat::RGB24));
+  stream->setReadAhead(8, true);
+  bool okay;
+  auto base = stream->property<Rational>(MediaProperty::TIMESCALE, okay);
+  auto rate = stream->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  const int64_t intvl = rate.invert() / base;
+
+  auto frame = stream->frameByTimestamp(0);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 0);
+  for (auto ix = 1; ix < 20; ++ix) {
+    frame = stream->frameByTimestamp();
+    ASSERT_TRUE(frame);
+    ASSERT_EQ(frame->timestamp(), ix * intvl);
+    ASSERT_TRUE(frame->data().data_ != nullptr);
+  }
+  // seeking backwards and forwards restarts the read-ahead
+  frame = stream->frameByTimestamp(5 * intvl);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 5 * intvl);
+  frame = stream->frameByTimestamp();
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 6 * intvl);
+  frame = stream->frameByTimestamp(40 * intvl);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 40 * intvl);
+
+  stream->setReadAhead(0);
+  frame = stream->frameByTimestamp(3 * intvl);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->timestamp(), 3 * intvl);
+}
+
+TEST (FFMpegStreamTest, BatchRead)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+  auto stream = src->visualStream(0);
+  ASSERT_TRUE(stream->setOutputFormat(PixelFormat::RGB24));
+  bool okay;
+  auto base = stream->property<Rational>(MediaProperty::TIMESCALE, okay);
+  auto rate = stream->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  const int64_t intvl = rate.invert() / base;
+
+  FrameBatch batch;
+  ASSERT_EQ(stream->readBatch(10, batch), 10);
+  std::vector<IMediaFrame*> objects;
+  for (size_t ix = 0; ix < batch.size(); ++ix) {
+    ASSERT_EQ(batch[ix]->timestamp(), static_cast<int64_t>(ix) * intvl);
+    ASSERT_TRUE(batch[ix]->data().data_ != nullptr);
+    objects.push_back(batch[ix].get());
+  }
+  // Frames held by the caller are not reused
+  auto held = batch[0];
+  ASSERT_EQ(stream->readBatch(10, batch), 10);
+  ASSERT_NE(batch[0].get(), held.get());
+  ASSERT_EQ(held->timestamp(), 0);
+  for (size_t ix = 0; ix < batch.size(); ++ix) {
+    ASSERT_EQ(batch[ix]->timestamp(), static_cast<int64_t>(ix + 10) * intvl);
+    ASSERT_TRUE(batch[ix]->data().data_ != nullptr);
+    if (ix > 0) {
+      ASSERT_EQ(batch[ix].get(), objects[ix]);
+    }
+  }
+}
+
+TEST (FFMpegStreamTest, FramesRange)
+{
+  std::string fname = "./ReferenceMedia/Video/h264/h264_yuv420p_avc1_fhd.mp4";
+  media_handling::MediaSourcePtr src = std::make_shared<FFMpegSource>(fname);
+  auto stream = src->visualStream(0);
+  bool okay;
+  auto base = stream->property<Rational>(MediaProperty::TIMESCALE, okay);
+  auto rate = stream->property<Rational>(MediaProperty::FRAME_RATE, okay);
+  const int64_t intvl = rate.invert() / base;
+
+  FrameBatch batch;
+  ASSERT_EQ(stream->frames(30 * intvl, 40 * intvl, batch), 10);
+  for (size_t ix = 0; ix < batch.size(); ++ix) {
+    ASSERT_EQ(batch[ix]->timestamp(), static_cast<int64_t>(ix + 30) * intvl);
+  }
+  ASSERT_EQ(stream->frames(5 * intvl, 8 * intvl, batch), 3);
+  ASSERT_EQ(batch[0]->timestamp(), 5 * intvl);
+  ASSERT_EQ(stream->frames(8 * intvl, 5 * intvl, batch), 0);
+  ASSERT_TRUE(batch.empty());
+}
+
 TEST (FFMpegStreamTest, StreamPropertiesLocked)
 {
   FFMpegSource source("./ReferenceMedia/Audio/ogg/monotone.ogg");
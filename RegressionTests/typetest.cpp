@@ -171,6 +171,70 @@ TEST (TypeTest, RationalFromDouble)
   ASSERT_FLOAT_EQ(g, e);
 }
 
+TEST (TypeTest, RationalNegativeDenominator)
+{
+  Rational a {1, -2};
+  ASSERT_EQ(a, Rational(-1, 2));
+  ASSERT_EQ(a.denominator(), 2);
+  ASSERT_TRUE(a < 0);
+  ASSERT_EQ(a.invert(), Rational(-2, 1));
+  ASSERT_EQ(Rational(-3, -6), Rational(1, 2));
+}
+
+TEST (TypeTest, RationalComparisons)
+{
+  Rational a {1, 3};
+  Rational b {2, 6};
+  ASSERT_TRUE(a >= b);
+  ASSERT_TRUE(a <= b);
+  ASSERT_FALSE(a < b);
+  ASSERT_TRUE(a <= 1);
+  ASSERT_TRUE(a >= 0);
+  ASSERT_TRUE(a < 0.34);
+  ASSERT_TRUE(a > 0.33);
+  // 1 ulp apart in double but not equal
+  Rational c {9'007'199'254'740'993LL, 9'007'199'254'740'992LL};
+  ASSERT_TRUE(c > 1);
+  ASSERT_TRUE(Rational(1) < c);
+}
+
+TEST (TypeTest, RationalLargeTimebase)
+{
+  // 90kHz timestamps ~24hrs in, multiplied and summed with broadcast timebases
+  const Rational tb {1, 90'000};
+  const Rational ts {7'776'000'000LL, 1};
+  ASSERT_EQ(ts * tb, Rational(86'400));
+  const Rational a {7'776'000'001LL, 90'000};
+  const Rational b {1'001, 30'000};
+  ASSERT_EQ(a + b, Rational(7'776'003'004LL, 90'000));
+  ASSERT_EQ(a - a, Rational(0));
+  // Products which exceed 64bits but reduce back into range
+  const Rational c {4'000'000'000LL, 3};
+  const Rational d {3, 4'000'000'000LL};
+  ASSERT_EQ(c * d, Rational(1));
+  ASSERT_TRUE(c > d);
+  ASSERT_TRUE(Rational(4'000'000'001LL, 3'000'000'000LL) < Rational(4'000'000'000LL, 2'999'999'999LL));
+}
+
+TEST (TypeTest, RationalRounding)
+{
+  ASSERT_EQ(static_cast<int64_t>(Rational(5, 2)), 3);
+  ASSERT_EQ(static_cast<int64_t>(Rational(-5, 2)), -3);
+  ASSERT_EQ(static_cast<int32_t>(Rational(7, 3)), 2);
+  ASSERT_EQ(static_cast<int64_t>(Rational(-7, 3)), -2);
+}
+
+TEST (TypeTest, RationalConstexpr)
+{
+  constexpr Rational a {30'000, 1'001};
+  constexpr Rational b = a.invert() * Rational(1, 90'000);
+  static_assert(Rational(2, 4) == Rational(1, 2));
+  static_assert(a > Rational(29));
+  static_assert(b == Rational(1'001, 2'700'000'000LL));
+  static_assert((a + a) == Rational(60'000, 1'001));
+  ASSERT_EQ(b.denominator(), 2'700'000'000LL);
+}
+
 //TEST (TypeTest, RationalGCD)
 //{
 //  Rational a {10,20};
@@ -0,0 +1,252 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "executor.h"
+
+#include <algorithm>
+#include <fmt/core.h>
+
+#include "logging.h"
+
+using media_handling::Executor;
+
+namespace
+{
+  /**
+   * @brief The executor and worker a thread belongs to, if any
+   */
+  thread_local const Executor* current_executor {nullptr};
+  thread_local size_t current_index {0};
+
+  std::mutex global_mutex;
+  std::shared_ptr<Executor> global_executor;
+
+  size_t workerCount(const size_t workers) noexcept
+  {
+    if (workers > 0) {
+      return workers;
+    }
+    return std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+  }
+}
+
+
+Executor::Executor(const size_t workers)
+{
+  const auto count = workerCount(workers);
+  workers_.reserve(count);
+  for (size_t ix = 0; ix < count; ++ix) {
+    workers_.emplace_back(std::make_unique<Worker>());
+  }
+  for (size_t ix = 0; ix < count; ++ix) {
+    workers_[ix]->thread_ = std::thread(&Executor::run, this, ix);
+  }
+}
+
+
+Executor::~Executor()
+{
+  {
+    std::lock_guard lock(sleep_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  // Queued tasks are run before the workers exit
+  for (auto& worker : workers_) {
+    if (worker->thread_.joinable()) {
+      worker->thread_.join();
+    }
+  }
+}
+
+
+std::shared_ptr<Executor> Executor::global()
+{
+  std::lock_guard lock(global_mutex);
+  if (!global_executor) {
+    global_executor = std::make_shared<Executor>(0);
+  }
+  return global_executor;
+}
+
+
+void Executor::configure(const size_t workers)
+{
+  auto executor = std::make_shared<Executor>(workers);
+  std::lock_guard lock(global_mutex);
+  // The previous executor finishes its work once its last user releases it
+  global_executor.swap(executor);
+}
+
+
+void Executor::submit(Task task)
+{
+  auto& worker = *workers_[currentWorker()];
+  {
+    // Counted before it is queued, as a worker may take it as soon as it is
+    std::lock_guard lock(sleep_mutex_);
+    ++pending_;
+  }
+  {
+    std::lock_guard lock(worker.mutex_);
+    worker.queue_.emplace_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+
+void Executor::parallelFor(const size_t count, const std::function<void(size_t)>& func)
+{
+  if (count == 0) {
+    return;
+  }
+  if (count == 1) {
+    func(0);
+    return;
+  }
+  struct State
+  {
+      /**
+       * @brief The next index not yet taken by a thread
+       */
+      std::atomic<size_t> next_ {0};
+      std::atomic<size_t> remaining_;
+      std::mutex mutex_;
+      std::condition_variable done_;
+  };
+  auto state = std::make_shared<State>();
+  state->remaining_ = count;
+  // Each thread takes indices until none are left. A task started after that returns without touching func
+  const auto drain = [state, &func, count] {
+    for (auto index = state->next_++; index < count; index = state->next_++) {
+      try {
+        func(index);
+      } catch (const std::exception& ex) {
+        LWARNING(fmt::format("Parallel task failed: {}", ex.what()));
+      }
+      if (--state->remaining_ == 0) {
+        std::lock_guard lock(state->mutex_);
+        state->done_.notify_all();
+      }
+    }
+  };
+  const auto helpers = std::min(count - 1, workers_.size());
+  for (size_t ix = 0; ix < helpers; ++ix) {
+    submit(drain);
+  }
+  // The calling thread takes indices too, rather than running other queued tasks whilst it waits. Those may be long,
+  // or wait on something held by the caller. Waiting is then only on indices already being run
+  drain();
+  std::unique_lock lock(state->mutex_);
+  state->done_.wait(lock, [&state] { return state->remaining_ == 0; });
+}
+
+
+size_t Executor::workers() const noexcept
+{
+  return workers_.size();
+}
+
+
+size_t Executor::pending() const noexcept
+{
+  return pending_;
+}
+
+
+uint64_t Executor::completed() const noexcept
+{
+  return completed_;
+}
+
+
+uint64_t Executor::stolen() const noexcept
+{
+  return stolen_;
+}
+
+
+void Executor::run(const size_t index)
+{
+  current_executor = this;
+  current_index = index;
+  while (true) {
+    if (runOne(index)) {
+      continue;
+    }
+    std::unique_lock lock(sleep_mutex_);
+    wake_.wait(lock, [this] { return stop_ || (pending_ > 0); });
+    if (stop_ && (pending_ == 0)) {
+      return;
+    }
+  }
+}
+
+
+bool Executor::runOne(const size_t index)
+{
+  Task task;
+  {
+    // Newest first from its own queue, as its data is the most likely to still be cached
+    auto& own = *workers_[index];
+    std::lock_guard lock(own.mutex_);
+    if (!own.queue_.empty()) {
+      task = std::move(own.queue_.back());
+      own.queue_.pop_back();
+    }
+  }
+  for (size_t ix = 1; !task && (ix < workers_.size()); ++ix) {
+    // Oldest first from others, leaving them their most recent work
+    auto& victim = *workers_[(index + ix) % workers_.size()];
+    std::lock_guard lock(victim.mutex_);
+    if (!victim.queue_.empty()) {
+      task = std::move(victim.queue_.front());
+      victim.queue_.pop_front();
+      ++stolen_;
+    }
+  }
+  if (!task) {
+    return false;
+  }
+  --pending_;
+  try {
+    task();
+  } catch (const std::exception& ex) {
+    LWARNING(fmt::format("Task failed: {}", ex.what()));
+  }
+  ++completed_;
+  return true;
+}
+
+
+size_t Executor::currentWorker() noexcept
+{
+  if (current_executor == this) {
+    return current_index;
+  }
+  return next_++ % workers_.size();
+}
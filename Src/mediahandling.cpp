@@ -26,6 +26,7 @@
 */
 
 #include "mediahandling.h"
+#include <algorithm>
 #include <iostream>
 #include <filesystem>
 #include <regex>
@@ -40,6 +41,8 @@
 constexpr auto DEFAULT_BACKEND_LOGS = true;
 static std::atomic<media_handling::BackendType> media_backend = media_handling::BackendType::FFMPEG;
 std::atomic<bool> media_handling::global::auto_detect_img_sequence = true;
+std::atomic<bool> media_handling::global::lazy_stream_properties = false;
+std::atomic<int32_t> media_handling::global::decode_thread_budget = 0;
 
 namespace mhl = media_handling::logging;
 
@@ -122,9 +125,10 @@ int media_handling::utils::getSequenceStartNumber(const std::string& path)
 }
 
 
-bool media_handling::initialise(const BackendType backend)
+bool media_handling::initialise(const BackendType backend, const size_t worker_threads)
 {
   enableBackendLogs(DEFAULT_BACKEND_LOGS);
+  Executor::configure(worker_threads);
   media_backend = backend;
   if (backend == BackendType::FFMPEG) {
     return true;
@@ -211,3 +215,23 @@ bool media_handling::autoDetectImageSequences() noexcept
 {
   return media_handling::global::auto_detect_img_sequence;
 }
+
+void media_handling::lazyStreamProperties(const bool value) noexcept
+{
+  media_handling::global::lazy_stream_properties = value;
+}
+
+bool media_handling::lazyStreamProperties() noexcept
+{
+  return media_handling::global::lazy_stream_properties;
+}
+
+void media_handling::decodeThreadBudget(const int32_t value) noexcept
+{
+  media_handling::global::decode_thread_budget = std::max(value, 0);
+}
+
+int32_t media_handling::decodeThreadBudget() noexcept
+{
+  return media_handling::global::decode_thread_budget;
+}
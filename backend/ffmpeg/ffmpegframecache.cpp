@@ -0,0 +1,169 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ffmpegframecache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <fmt/core.h>
+
+#include "mediahandling.h"
+
+using media_handling::ffmpeg::FFMpegFrameCache;
+namespace mft = media_handling::ffmpeg::types;
+
+namespace
+{
+  /**
+   * @brief Size of the buffers referenced by a frame. Planes may share a buffer so lineSize*height is not used
+   */
+  size_t bufferSize(const AVFrame& frame) noexcept
+  {
+    size_t total = 0;
+    for (const auto buf : frame.buf) {
+      if (buf != nullptr) {
+        total += static_cast<size_t>(buf->size);
+      }
+    }
+    for (auto ix = 0; ix < frame.nb_extended_buf; ++ix) {
+      total += static_cast<size_t>(frame.extended_buf[ix]->size);
+    }
+    return total;
+  }
+}
+
+
+void FFMpegFrameCache::setBudget(const size_t bytes)
+{
+  budget_ = bytes;
+  evict(0);
+}
+
+size_t FFMpegFrameCache::budget() const noexcept
+{
+  return budget_;
+}
+
+bool FFMpegFrameCache::enabled() const noexcept
+{
+  return budget_ > 0;
+}
+
+mft::AVFrameUPtr FFMpegFrameCache::find(const int64_t pts)
+{
+  if (!enabled()) {
+    return nullptr;
+  }
+  // The last frame starting at or before pts is the only candidate
+  if (auto it = lookup_.upper_bound(pts); it != lookup_.begin()) {
+    const auto entry = std::prev(it)->second;
+    if (pts < (entry->pts_ + std::max<int64_t>(entry->duration_, 1))) {
+      types::AVFrameUPtr frame(av_frame_alloc());
+      if (const auto ret = av_frame_ref(frame.get(), entry->frame_.get()); ret < 0) {
+        LWARNING(fmt::format("Failed to reference cached frame, pts={}", entry->pts_));
+        return nullptr;
+      }
+      entries_.splice(entries_.begin(), entries_, entry);
+      ++hits_;
+      return frame;
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+void FFMpegFrameCache::insert(const AVFrame& frame)
+{
+  // Keyed as decodeByTimestamp() matches frames
+  const auto pts = types::frameTimestamp(frame);
+  if (!enabled() || (pts == AV_NOPTS_VALUE)) {
+    return;
+  }
+  if (const auto it = lookup_.find(pts); it != lookup_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  const auto size = bufferSize(frame);
+  if (size > budget_) {
+    return;
+  }
+  types::AVFrameUPtr ref(av_frame_alloc());
+  if (const auto ret = av_frame_ref(ref.get(), &frame); ret < 0) {
+    LWARNING(fmt::format("Failed to reference frame for caching, pts={}", pts));
+    return;
+  }
+  evict(size);
+  entries_.push_front({std::move(ref), pts, frame.pkt_duration, size});
+  lookup_[pts] = entries_.begin();
+  bytes_ += size;
+}
+
+void FFMpegFrameCache::clear() noexcept
+{
+  lookup_.clear();
+  entries_.clear();
+  bytes_ = 0;
+}
+
+size_t FFMpegFrameCache::size() const noexcept
+{
+  return entries_.size();
+}
+
+size_t FFMpegFrameCache::bytes() const noexcept
+{
+  return bytes_;
+}
+
+int64_t FFMpegFrameCache::hits() const noexcept
+{
+  return hits_;
+}
+
+int64_t FFMpegFrameCache::misses() const noexcept
+{
+  return misses_;
+}
+
+int64_t FFMpegFrameCache::evictions() const noexcept
+{
+  return evictions_;
+}
+
+
+void FFMpegFrameCache::evict(const size_t required)
+{
+  while (!entries_.empty() && ((bytes_ + required) > budget_)) {
+    const auto& entry = entries_.back();
+    assert(bytes_ >= entry.bytes_);
+    bytes_ -= entry.bytes_;
+    lookup_.erase(entry.pts_);
+    entries_.pop_back();
+    ++evictions_;
+  }
+}
@@ -0,0 +1,103 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FFMPEGFRAMECACHE_H
+#define FFMPEGFRAMECACHE_H
+
+#include <list>
+#include <map>
+#include <cstdint>
+
+#include "ffmpegtypes.h"
+
+namespace media_handling::ffmpeg
+{
+  /**
+   * @brief A least-recently-used cache of decoded frames, keyed by presentation timestamp and limited by a byte budget
+   * @note  Frames are held by reference to their decoder buffers so neither insertion nor retrieval copies pixel/sample data
+   */
+  class FFMpegFrameCache
+  {
+    public:
+      FFMpegFrameCache() = default;
+
+      /**
+       * @brief       Set the maximum size of frame data to be held
+       * @param bytes 0 disables the cache
+       */
+      void setBudget(const size_t bytes);
+      size_t budget() const noexcept;
+      bool enabled() const noexcept;
+
+      /**
+       * @brief       Retrieve the frame presented at a timestamp
+       * @param pts   Presentation timestamp in stream timebase units. Can be anywhere within the frame's duration
+       * @return      A new reference to the cached frame or null
+       */
+      types::AVFrameUPtr find(const int64_t pts);
+
+      /**
+       * @brief       Hold a reference to a decoded frame, evicting the least recently used frames to stay within budget
+       */
+      void insert(const AVFrame& frame);
+      void clear() noexcept;
+
+      size_t size() const noexcept;
+      /**
+       * @brief Size of the frame data currently held
+       */
+      size_t bytes() const noexcept;
+      int64_t hits() const noexcept;
+      int64_t misses() const noexcept;
+      int64_t evictions() const noexcept;
+
+    private:
+      struct Entry
+      {
+          types::AVFrameUPtr frame_ {nullptr};
+          int64_t pts_ {0};
+          int64_t duration_ {0};
+          size_t bytes_ {0};
+      };
+      using Entries = std::list<Entry>;
+      /**
+       * @brief Most recently used at the front
+       */
+      Entries entries_;
+      std::map<int64_t, Entries::iterator> lookup_;
+      size_t budget_ {0};
+      size_t bytes_ {0};
+      int64_t hits_ {0};
+      int64_t misses_ {0};
+      int64_t evictions_ {0};
+
+    private:
+      void evict(const size_t required);
+  };
+}
+
+#endif // FFMPEGFRAMECACHE_H
@@ -0,0 +1,144 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ffmpegframepool.h"
+
+#include <cassert>
+#include <stdexcept>
+#include <fmt/core.h>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include "mediahandling.h"
+
+using media_handling::ffmpeg::FFMpegFramePool;
+namespace mft = media_handling::ffmpeg::types;
+
+namespace
+{
+  /**
+   * @brief Sufficient for the widest SIMD used by swscale/swresample
+   */
+  constexpr auto ALIGNMENT = 64;
+}
+
+
+FFMpegFramePool::FFMpegFramePool(const AVPixelFormat format, const Dimensions& dims)
+  : format_(format),
+    width_(dims.width),
+    height_(dims.height)
+{
+  const auto size = av_image_get_buffer_size(format, dims.width, dims.height, ALIGNMENT);
+  if (size <= 0) {
+    throw std::runtime_error(fmt::format("Invalid frame pool format, fmt={}, width={}, height={}",
+                                         format, dims.width, dims.height));
+  }
+  pool_ = av_buffer_pool_init2(size, this, &FFMpegFramePool::allocate, nullptr);
+}
+
+
+FFMpegFramePool::FFMpegFramePool(const AVSampleFormat format, const uint64_t layout, const int32_t sample_rate,
+                                 const int32_t samples)
+  : format_(format),
+    layout_(layout),
+    channels_(av_get_channel_layout_nb_channels(layout)),
+    sample_rate_(sample_rate),
+    samples_(samples)
+{
+  if (channels_ > AV_NUM_DATA_POINTERS) {
+    // Would need extended_data allocating per frame
+    throw std::runtime_error(fmt::format("Too many channels for a frame pool, channels={}", channels_));
+  }
+  const auto size = av_samples_get_buffer_size(nullptr, channels_, samples, format, ALIGNMENT);
+  if (size <= 0) {
+    throw std::runtime_error(fmt::format("Invalid frame pool format, fmt={}, channels={}, samples={}",
+                                         format, channels_, samples));
+  }
+  pool_ = av_buffer_pool_init2(size, this, &FFMpegFramePool::allocate, nullptr);
+}
+
+
+FFMpegFramePool::~FFMpegFramePool()
+{
+  // Actually freed once all buffers are returned
+  av_buffer_pool_uninit(&pool_);
+}
+
+
+mft::AVFrameUPtr FFMpegFramePool::acquire()
+{
+  assert(pool_);
+  types::AVFrameUPtr frame(av_frame_alloc());
+  if (!frame) {
+    return nullptr;
+  }
+  frame->buf[0] = av_buffer_pool_get(pool_);
+  if (frame->buf[0] == nullptr) {
+    LCRITICAL("Failed to retrieve a buffer from the frame pool");
+    return nullptr;
+  }
+  frame->format = format_;
+  int ret = 0;
+  if (channels_ > 0) {
+    frame->channel_layout = layout_;
+    frame->channels = channels_;
+    frame->sample_rate = sample_rate_;
+    frame->nb_samples = samples_;
+    ret = av_samples_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, channels_, samples_,
+                                 static_cast<AVSampleFormat>(format_), ALIGNMENT);
+    frame->extended_data = frame->data;
+  } else {
+    frame->width = width_;
+    frame->height = height_;
+    ret = av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data,
+                               static_cast<AVPixelFormat>(format_), width_, height_, ALIGNMENT);
+  }
+  if (ret < 0) {
+    LCRITICAL("Failed to populate a frame from the frame pool");
+    return nullptr;
+  }
+  return frame;
+}
+
+
+int64_t FFMpegFramePool::allocations() const noexcept
+{
+  return allocations_;
+}
+
+
+AVBufferRef* FFMpegFramePool::allocate(void* opaque, int size)
+{
+  auto pool = static_cast<FFMpegFramePool*>(opaque);
+  assert(pool);
+  ++pool->allocations_;
+  return av_buffer_alloc(size);
+}
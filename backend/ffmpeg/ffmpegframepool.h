@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FFMPEGFRAMEPOOL_H
+#define FFMPEGFRAMEPOOL_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "ffmpegtypes.h"
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+namespace media_handling::ffmpeg
+{
+  /**
+   * @brief An AVBufferPool backed source of frames of one format, for holding converted output
+   * @note  The buffers of released frames are reused by the next acquired. The pool itself is only freed once every
+   *        frame taken from it has been
+   */
+  class FFMpegFramePool
+  {
+    public:
+      /**
+       * @brief         Pool of video frames
+       * @note          Throws if the format is invalid
+       */
+      FFMpegFramePool(const AVPixelFormat format, const Dimensions& dims);
+      /**
+       * @brief         Pool of audio frames
+       * @note          Throws if the format is invalid
+       * @param samples The capacity of each frame, in samples per channel
+       */
+      FFMpegFramePool(const AVSampleFormat format, const uint64_t layout, const int32_t sample_rate, const int32_t samples);
+      ~FFMpegFramePool();
+      FFMpegFramePool(const FFMpegFramePool&) = delete;
+      FFMpegFramePool& operator=(const FFMpegFramePool&) = delete;
+
+      /**
+       * @brief Retrieve a writable frame of the pool's format
+       * @return frame or null on failure
+       */
+      types::AVFrameUPtr acquire();
+
+      /**
+       * @brief The number of buffers the pool has had to allocate
+       */
+      int64_t allocations() const noexcept;
+
+    private:
+      AVBufferPool* pool_ {nullptr};
+      int format_ {-1};
+      int32_t width_ {0};
+      int32_t height_ {0};
+      uint64_t layout_ {0};
+      int32_t channels_ {0};
+      int32_t sample_rate_ {0};
+      int32_t samples_ {0};
+      std::atomic<int64_t> allocations_ {0};
+
+    private:
+      static AVBufferRef* allocate(void* opaque, int size);
+  };
+}
+
+#endif // FFMPEGFRAMEPOOL_H
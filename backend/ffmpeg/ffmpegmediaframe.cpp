@@ -27,12 +27,15 @@
 
 #include "ffmpegmediaframe.h"
 
+#include <array>
 #include <cassert>
 #include <fmt/core.h>
 extern "C" {
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 }
+#include "executor.h"
 #include "mediahandling.h"
 #include "ffmpegtypes.h"
 
@@ -46,7 +49,7 @@ constexpr auto ERR_LEN = 1024;
 
 namespace
 {
-  std::string err(ERR_LEN, '\0');
+  thread_local std::string err(ERR_LEN, '\0');
 }
 
 
@@ -56,8 +59,7 @@ FFMpegMediaFrame::FFMpegMediaFrame(types::AVFrameUPtr frame, const bool visual)
     is_visual_(visual)
 {
   assert(ff_frame_);
-  timestamp_ = ff_frame_->pts;
-  MediaPropertyObject::setProperty(MediaProperty::DURATION, Rational(ff_frame_->pkt_duration));
+  timestamp_ = mft::frameTimestamp(*ff_frame_);
 }
 
 
@@ -68,10 +70,68 @@ FFMpegMediaFrame::FFMpegMediaFrame(types::AVFrameUPtr frame, const bool visual,
     output_fmt_(std::move(format))
 {
   assert(ff_frame_);
-  timestamp_ = ff_frame_->pts;
-  MediaPropertyObject::setProperty(MediaProperty::DURATION, Rational(ff_frame_->pkt_duration));
+  timestamp_ = mft::frameTimestamp(*ff_frame_);
 }
 
+bool FFMpegMediaFrame::hasProperty(const MediaProperty prop) const
+{
+  if ( (prop == MediaProperty::DURATION) && ff_frame_) {
+    return true;
+  }
+  return MediaPropertyObject::hasProperty(prop);
+}
+
+
+std::any FFMpegMediaFrame::property(const MediaProperty prop, bool& is_valid) const
+{
+  auto value = MediaPropertyObject::property(prop, is_valid);
+  if (!is_valid && (prop == MediaProperty::DURATION) && ff_frame_) {
+    // Derived on request rather than stored on construction, as frames are created at decode rate
+    is_valid = true;
+    return Rational(ff_frame_->pkt_duration);
+  }
+  return value;
+}
+
+
+std::map<MediaProperty, std::any> FFMpegMediaFrame::properties() const
+{
+  auto props = MediaPropertyObject::properties();
+  if (ff_frame_) {
+    props.try_emplace(MediaProperty::DURATION, Rational(ff_frame_->pkt_duration));
+  }
+  return props;
+}
+
+
+void FFMpegMediaFrame::reset(types::AVFrameUPtr frame, const InOutFormat& format)
+{
+  assert(frame);
+  ff_frame_ = std::move(frame);
+  timestamp_ = mft::frameTimestamp(*ff_frame_);
+  frame_data_.reset();
+  MediaPropertyObject::setProperties({});
+  if ( (format.sws_context_ != output_fmt_.sws_context_)
+       || (format.swr_context_ != output_fmt_.swr_context_)
+       || (format.allocator_ != output_fmt_.allocator_) ) {
+    setOutputFormat(format);
+  } else {
+    // The conversion buffer is kept as the output format is unchanged
+    invalidate();
+  }
+}
+
+
+mft::AVFrameUPtr FFMpegMediaFrame::release()
+{
+  if (!ff_frame_) {
+    return mft::AVFrameUPtr(av_frame_alloc());
+  }
+  av_frame_unref(ff_frame_.get());
+  return std::move(ff_frame_);
+}
+
+
 std::optional<bool> FFMpegMediaFrame::isAudio() const
 {
   return is_audio_;
@@ -98,13 +158,154 @@ media_handling::IMediaFrame::FrameData FFMpegMediaFrame::data() noexcept
   {
     return frame_data_.value();
   }
+  if (!converted_) {
+    const auto start = std::chrono::steady_clock::now();
+    auto f_d = convert();
+    conversion_time_ += std::chrono::steady_clock::now() - start;
+    ++conversion_count_;
+    if (f_d.data_ == nullptr) {
+      // Failed, so allow a retry
+      return f_d;
+    }
+    converted_ = f_d;
+  }
+  return converted_.value();
+}
+
+
+void FFMpegMediaFrame::invalidate() noexcept
+{
+  converted_.reset();
+}
+
+
+void FFMpegMediaFrame::setOutputFormat(InOutFormat format)
+{
+  output_fmt_ = std::move(format);
+  // Buffer was sized for the previous format
+  conv_frame_.reset();
+  invalidate();
+}
+
+
+int32_t FFMpegMediaFrame::conversionCount() const noexcept
+{
+  return conversion_count_;
+}
+
+
+std::chrono::nanoseconds FFMpegMediaFrame::conversionTime() const noexcept
+{
+  return conversion_time_;
+}
+
+
+const AVFrame* FFMpegMediaFrame::dataFrame() noexcept
+{
+  const auto frame_data = data();
+  if (frame_data_ || (frame_data.data_ == nullptr)) {
+    return nullptr;
+  }
+  if (conv_frame_ && (frame_data.data_ == conv_frame_->data)) {
+    return conv_frame_.get();
+  }
+  return ff_frame_.get();
+}
+
+
+bool FFMpegMediaFrame::scaleBands(const std::vector<Band>& bands, const AVFrame& src, AVFrame& dst)
+{
+  if (bands.empty() || (src.height != (bands.back().y_ + bands.back().height_))
+      || (bands.front().sws_context_ == nullptr) ) {
+    return false;
+  }
+  const auto src_desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(src.format));
+  const auto dst_desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(dst.format));
+  if ( (src_desc == nullptr) || (dst_desc == nullptr) ) {
+    return false;
+  }
+  // Offset each plane to the band's first row, allowing for vertically subsampled chroma
+  const auto offsetPlanes = [] (const AVPixFmtDescriptor& desc, uint8_t* const* data, const int* linesize,
+                                const int y, std::array<uint8_t*, 4>& planes) {
+    for (size_t ix = 0; ix < planes.size(); ++ix) {
+      if (data[ix] == nullptr) {
+        planes[ix] = nullptr;
+        continue;
+      }
+      const auto chroma = ( (ix == 1) || (ix == 2) ) && (desc.nb_components > 2);
+      const auto row = chroma ? (y >> desc.log2_chroma_h) : y;
+      planes[ix] = data[ix] + static_cast<ptrdiff_t>(row) * linesize[ix];
+    }
+  };
+  Executor::global()->parallelFor(bands.size(), [&] (const size_t index) {
+    const auto& band = bands[index];
+    std::array<uint8_t*, 4> src_planes {};
+    std::array<uint8_t*, 4> dst_planes {};
+    offsetPlanes(*src_desc, src.data, src.linesize, band.y_, src_planes);
+    offsetPlanes(*dst_desc, dst.data, dst.linesize, band.y_, dst_planes);
+    sws_scale(band.sws_context_.get(), src_planes.data(), src.linesize, 0, band.height_, dst_planes.data(),
+              dst.linesize);
+  });
+  return true;
+}
+
+
+std::unique_lock<std::mutex> FFMpegMediaFrame::lockConversion() const
+{
+  if (!output_fmt_.mutex_) {
+    return {};
+  }
+  return std::unique_lock(*output_fmt_.mutex_);
+}
+
+
+bool FFMpegMediaFrame::convertFast()
+{
+  const auto& fast = output_fmt_.fast_conversion_;
+  // The decoder may have changed format or size since the output format was set
+  if (!fast || (ff_frame_->format != fast->source()) || (conv_frame_->format != fast->destination())
+      || (ff_frame_->width != conv_frame_->width) || (ff_frame_->height != conv_frame_->height) ) {
+    return false;
+  }
+  if (!output_fmt_.bands_ || output_fmt_.bands_->empty()
+      || (ff_frame_->height != (output_fmt_.bands_->back().y_ + output_fmt_.bands_->back().height_)) ) {
+    return fast->convert(*ff_frame_, *conv_frame_);
+  }
+  const auto& bands = *output_fmt_.bands_;
+  Executor::global()->parallelFor(bands.size(), [&] (const size_t index) {
+    fast->convert(*ff_frame_, *conv_frame_, bands[index].y_, bands[index].height_);
+  });
+  return true;
+}
+
+
+media_handling::IMediaFrame::FrameData FFMpegMediaFrame::convert()
+{
   assert(ff_frame_);
   media_handling::IMediaFrame::FrameData f_d;
-  f_d.timestamp_ = ff_frame_->best_effort_timestamp; // value lost in resampled frame
+  f_d.timestamp_ = timestamp_; // value lost in resampled frame
   int ret = 0;
+  if (conv_frame_ && (conv_frame_->buf[0] != nullptr) && !av_buffer_is_writable(conv_frame_->buf[0])) {
+    // An encoder still references the previous conversion, so it is left to it and a new buffer converted into
+    conv_frame_.reset();
+  }
   if (is_visual_ && (is_visual_ == true) && output_fmt_.sws_context_) {
+    if ( (conv_frame_ == nullptr) && output_fmt_.allocator_) {
+      conv_frame_.reset(av_frame_alloc());
+      conv_frame_->format = mft::convertPixelFormat(output_fmt_.pix_fmt_);
+      conv_frame_->width = output_fmt_.dims_.width;
+      conv_frame_->height = output_fmt_.dims_.height;
+      ret = mft::allocateFrameBuffer(*conv_frame_, output_fmt_.allocator_, conv_frame_->width, conv_frame_->height);
+      if (ret < 0) {
+        av_strerror(ret, err.data(), ERR_LEN);
+        LWARNING(fmt::format("Could not allocate frame buffer from the application: {}", err.data()));
+        conv_frame_.reset();
+      }
+    }
+    if ( (conv_frame_ == nullptr) && output_fmt_.frame_pool_) {
+      conv_frame_ = output_fmt_.frame_pool_->acquire();
+    }
     if (conv_frame_ == nullptr) {
-      // FIXME: this doesn't allow for changes to putput format after the first set
       conv_frame_.reset(av_frame_alloc());
       conv_frame_->format = mft::convertPixelFormat(output_fmt_.pix_fmt_);
       conv_frame_->width = output_fmt_.dims_.width;
@@ -113,13 +314,19 @@ media_handling::IMediaFrame::FrameData FFMpegMediaFrame::data() noexcept
     }
     // change the pixel format
     assert(conv_frame_);
-    ret = sws_scale(output_fmt_.sws_context_.get(),
-                    static_cast<const uint8_t* const*>(ff_frame_->data),
-                    ff_frame_->linesize,
-                    0,
-                    ff_frame_->height,
-                    conv_frame_->data,
-                    conv_frame_->linesize);
+    if (!convertFast()) {
+      // The read-ahead task and the application may be converting other frames of the stream at the same time
+      const auto lock = lockConversion();
+      if (!(output_fmt_.bands_ && scaleBands(*output_fmt_.bands_, *ff_frame_, *conv_frame_))) {
+        ret = sws_scale(output_fmt_.sws_context_.get(),
+                        static_cast<const uint8_t* const*>(ff_frame_->data),
+                        ff_frame_->linesize,
+                        0,
+                        ff_frame_->height,
+                        conv_frame_->data,
+                        conv_frame_->linesize);
+      }
+    }
     f_d.data_ = conv_frame_->data;
     f_d.dims_ = {conv_frame_->width, conv_frame_->height};
     f_d.line_size_ = conv_frame_->linesize[0];
@@ -130,12 +337,15 @@ media_handling::IMediaFrame::FrameData FFMpegMediaFrame::data() noexcept
                                                                   1));
   } else if (is_audio_ && (is_audio_ == true) && output_fmt_.swr_context_) {
     // change the sample format
+    if ( (conv_frame_ == nullptr) && output_fmt_.frame_pool_) {
+      conv_frame_ = output_fmt_.frame_pool_->acquire();
+    }
     if (conv_frame_ == nullptr) {
       conv_frame_.reset(av_frame_alloc());
       conv_frame_->channel_layout = types::convertChannelLayout(output_fmt_.layout_);
       conv_frame_->sample_rate = output_fmt_.sample_rate_;
       conv_frame_->format = types::convertSampleFormat(output_fmt_.sample_fmt_);
-      conv_frame_->nb_samples = 1000;
+      conv_frame_->nb_samples = AUDIO_CONVERSION_SAMPLES;
       ret = av_frame_get_buffer(conv_frame_.get(), 0);
       if (ret < 0) {
           av_strerror(ret, err.data(), ERR_LEN);
@@ -149,7 +359,10 @@ media_handling::IMediaFrame::FrameData FFMpegMediaFrame::data() noexcept
           return {};
       }
     }
-    ret = swr_convert_frame(output_fmt_.swr_context_.get(), conv_frame_.get(), ff_frame_.get());
+    {
+      const auto lock = lockConversion();
+      ret = swr_convert_frame(output_fmt_.swr_context_.get(), conv_frame_.get(), ff_frame_.get());
+    }
     if (ret < 0) {
         av_strerror(ret, err.data(), ERR_LEN);
         LCRITICAL(fmt::format("Could not resample audio frame: {}", err.data()));
@@ -28,7 +28,13 @@
 #ifndef FFMPEGMEDIAFRAME_H
 #define FFMPEGMEDIAFRAME_H
 
+#include <chrono>
+#include <mutex>
+#include <vector>
+
 #include "imediaframe.h"
+#include "ffmpegframepool.h"
+#include "ffmpegpixelconvert.h"
 #include "ffmpegtypes.h"
 
 extern "C" {
@@ -39,10 +45,28 @@ extern "C" {
 
 namespace media_handling::ffmpeg
 {
+  /**
+   * @brief The capacity, in samples per channel, of a frame holding resampled audio
+   */
+  constexpr int32_t AUDIO_CONVERSION_SAMPLES = 1000;
+
 
   class FFMpegMediaFrame : public IMediaFrame
   {
     public:
+      /**
+       * @brief A horizontal band of a pixel conversion, with a context of its own so that bands convert in parallel
+       */
+      struct Band
+      {
+          types::SWSContextPtr sws_context_ {nullptr};
+          /**
+           * @brief First row of the band, which is the same in the source and output
+           */
+          int y_ {0};
+          int height_ {0};
+      };
+
       struct InOutFormat
       {
           // Needed as there's no documented way to identify how swr/swscontexts were created
@@ -53,12 +77,83 @@ namespace media_handling::ffmpeg
           ChannelLayout layout_ {ChannelLayout::UNKNOWN};
           int32_t sample_rate_ {-1};
           Dimensions dims_;
+          /**
+           * @brief Buffers for the converted output, shared by all frames with this format
+           */
+          std::shared_ptr<FFMpegFramePool> frame_pool_ {nullptr};
+          /**
+           * @brief The conversion split into bands, used in place of sws_context_ if set
+           */
+          std::shared_ptr<const std::vector<Band>> bands_ {nullptr};
+          /**
+           * @brief Application memory for the converted output, preferred over frame_pool_
+           */
+          BufferAllocatorPtr allocator_ {nullptr};
+          /**
+           * @brief Vectorised conversion used in place of sws_context_ if set. Splits into bands_ with no contexts
+           */
+          std::optional<FFMpegPixelConversion> fast_conversion_;
+          /**
+           * @brief Held whilst converting, as the contexts are shared by every frame with this format and are not
+           *        reentrant
+           */
+          std::shared_ptr<std::mutex> mutex_ {nullptr};
       };
 
       FFMpegMediaFrame() = default;
       FFMpegMediaFrame(types::AVFrameUPtr frame, const bool visual);
       FFMpegMediaFrame(types::AVFrameUPtr frame, const bool visual, InOutFormat format);
 
+    public: /* MediaPropertyObject overrides */
+      bool hasProperty(const MediaProperty prop) const override;
+      std::any property(const MediaProperty prop, bool& is_valid) const override;
+      std::map<MediaProperty, std::any> properties() const override;
+      using MediaPropertyObject::property;
+
+    public:
+      /**
+       * @brief         Hold a newly decoded frame, so that this object can be reused instead of another allocated
+       * @note          The conversion buffer is kept if the output format is unchanged
+       * @param frame   The decoded frame
+       * @param format  The output format of the stream
+       */
+      void reset(types::AVFrameUPtr frame, const InOutFormat& format);
+      /**
+       * @brief   Release the held frame, unreferenced, so that it can be decoded into again
+       * @return  The frame, or a newly allocated one if none was held
+       */
+      types::AVFrameUPtr release();
+      /**
+       * @brief Discard the converted output so that the next data() call converts again
+       */
+      void invalidate() noexcept;
+      /**
+       * @brief         Change the output format of this frame
+       * @note          The converted output is invalidated
+       * @param format  New output format
+       */
+      void setOutputFormat(InOutFormat format);
+      /**
+       * @brief The number of times the output of this frame has been converted
+       */
+      int32_t conversionCount() const noexcept;
+      /**
+       * @brief The total time spent converting the output of this frame
+       */
+      std::chrono::nanoseconds conversionTime() const noexcept;
+      /**
+       * @brief   The frame that data() describes, which is the converted one if there was a conversion
+       * @return  frame or null if there is no data or it was set with setData()
+       */
+      const AVFrame* dataFrame() noexcept;
+
+      /**
+       * @brief         Convert a frame's pixels band by band on the library's worker pool
+       * @param bands   Bands of a conversion between the formats, of the frames' height
+       * @return        true==converted
+       */
+      static bool scaleBands(const std::vector<Band>& bands, const AVFrame& src, AVFrame& dst);
+
     public: /* IMediaFrame overrides */
       std::optional<bool> isAudio() const override;
       std::optional<bool> isVisual() const override;
@@ -76,10 +171,26 @@ namespace media_handling::ffmpeg
       int64_t timestamp_ {-1};
       InOutFormat output_fmt_;
       std::optional<FrameData> frame_data_;
+      /**
+       * @brief The output of data(), memoised as converting is expensive and resampling is stateful
+       */
+      std::optional<FrameData> converted_;
+      int32_t conversion_count_ {0};
+      std::chrono::nanoseconds conversion_time_ {0};
 
     private:
       void extractVisualProperties();
       void extractAudioProperties();
+      FrameData convert();
+      /**
+       * @brief Convert the frame's pixels with the format's vectorised conversion, in bands if it has them
+       * @return  true==converted
+       */
+      bool convertFast();
+      /**
+       * @brief Lock the output format's contexts, if it has a mutex
+       */
+      std::unique_lock<std::mutex> lockConversion() const;
   };
 }
 
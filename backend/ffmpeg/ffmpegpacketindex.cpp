@@ -0,0 +1,181 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ffmpegpacketindex.h"
+
+#include <algorithm>
+#include <limits>
+
+using media_handling::ffmpeg::FFMpegPacketIndex;
+
+namespace
+{
+  /**
+   * @brief Not every container populates pts for every packet so fall back to dts
+   */
+  int64_t presentationTime(const int64_t pts, const int64_t dts) noexcept
+  {
+    return pts != AV_NOPTS_VALUE ? pts : dts;
+  }
+}
+
+
+void FFMpegPacketIndex::append(const AVPacket& packet)
+{
+  if ( (packet.flags & AV_PKT_FLAG_KEY) != 0) {
+    keyframes_.push_back(pts_.size());
+  }
+  pts_.push_back(packet.pts);
+  dts_.push_back(packet.dts);
+  pos_.push_back(packet.pos);
+  duration_.push_back(packet.duration);
+  size_.push_back(packet.size);
+  total_size_ += packet.size;
+}
+
+void FFMpegPacketIndex::reserve(const size_t count)
+{
+  pts_.reserve(count);
+  dts_.reserve(count);
+  pos_.reserve(count);
+  duration_.reserve(count);
+  size_.reserve(count);
+}
+
+void FFMpegPacketIndex::clear() noexcept
+{
+  pts_.clear();
+  dts_.clear();
+  pos_.clear();
+  duration_.clear();
+  size_.clear();
+  keyframes_.clear();
+  total_size_ = 0;
+}
+
+size_t FFMpegPacketIndex::size() const noexcept
+{
+  return pts_.size();
+}
+
+bool FFMpegPacketIndex::empty() const noexcept
+{
+  return pts_.empty();
+}
+
+int64_t FFMpegPacketIndex::pts(const size_t index) const
+{
+  return pts_.at(index);
+}
+
+int64_t FFMpegPacketIndex::dts(const size_t index) const
+{
+  return dts_.at(index);
+}
+
+int64_t FFMpegPacketIndex::timestamp(const size_t index) const
+{
+  return presentationTime(pts_.at(index), dts_.at(index));
+}
+
+int64_t FFMpegPacketIndex::position(const size_t index) const
+{
+  return pos_.at(index);
+}
+
+int32_t FFMpegPacketIndex::packetSize(const size_t index) const
+{
+  return size_.at(index);
+}
+
+bool FFMpegPacketIndex::isKeyframe(const size_t index) const
+{
+  return std::binary_search(keyframes_.begin(), keyframes_.end(), index);
+}
+
+int64_t FFMpegPacketIndex::totalSize() const noexcept
+{
+  return total_size_;
+}
+
+int64_t FFMpegPacketIndex::duration() const noexcept
+{
+  // Packets are in decode order so the presentation start/end have to be searched for
+  auto start = std::numeric_limits<int64_t>::max();
+  auto end = std::numeric_limits<int64_t>::min();
+  for (size_t ix = 0; ix < pts_.size(); ++ix) {
+    const auto ts = presentationTime(pts_[ix], dts_[ix]);
+    if (ts == AV_NOPTS_VALUE) {
+      continue;
+    }
+    start = std::min(start, ts);
+    end = std::max(end, ts + duration_[ix]);
+  }
+  if (end < start) {
+    return 0;
+  }
+  return end - start;
+}
+
+std::optional<size_t> FFMpegPacketIndex::keyframeBefore(const int64_t pts) const
+{
+  // keyframes are presented in decode order, unlike the frames that reference them
+  const auto it = std::upper_bound(keyframes_.begin(), keyframes_.end(), pts,
+                                   [this] (const int64_t ts, const size_t ix) {
+    return ts < presentationTime(pts_[ix], dts_[ix]);
+  });
+  if (it == keyframes_.begin()) {
+    return {};
+  }
+  return *std::prev(it);
+}
+
+std::optional<size_t> FFMpegPacketIndex::keyframeAfter(const int64_t pts) const
+{
+  const auto it = std::lower_bound(keyframes_.begin(), keyframes_.end(), pts,
+                                   [this] (const size_t ix, const int64_t ts) {
+    return presentationTime(pts_[ix], dts_[ix]) < ts;
+  });
+  if (it == keyframes_.end()) {
+    return {};
+  }
+  return *it;
+}
+
+size_t FFMpegPacketIndex::packetsUntil(const size_t key, const int64_t pts) const
+{
+  // Open GOPs may present the leading frames of the next GOP before its keyframe so search up to the one after
+  const auto next = std::upper_bound(keyframes_.begin(), keyframes_.end(), key);
+  const auto last = std::distance(next, keyframes_.end()) > 1 ? *std::next(next) : pts_.size();
+  size_t count = 0;
+  for (size_t ix = key; ix < last; ++ix) {
+    if (presentationTime(pts_[ix], dts_[ix]) <= pts) {
+      count = ix - key + 1;
+    }
+  }
+  return count;
+}
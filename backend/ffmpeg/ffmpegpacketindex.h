@@ -0,0 +1,119 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FFMPEGPACKETINDEX_H
+#define FFMPEGPACKETINDEX_H
+
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace media_handling::ffmpeg
+{
+  /**
+   * @brief A per-stream index of demuxed packets, built without decoding
+   * @note  Stored column-wise (one vector per field) in decode order so that lookups only touch the fields needed
+   */
+  class FFMpegPacketIndex
+  {
+    public:
+      FFMpegPacketIndex() = default;
+
+      /**
+       * @brief Record a demuxed packet
+       */
+      void append(const AVPacket& packet);
+      void reserve(const size_t count);
+      void clear() noexcept;
+      size_t size() const noexcept;
+      bool empty() const noexcept;
+
+      int64_t pts(const size_t index) const;
+      int64_t dts(const size_t index) const;
+      /**
+       * @brief Presentation timestamp of the packet, or the decode timestamp if the container did not set one
+       */
+      int64_t timestamp(const size_t index) const;
+      /**
+       * @brief Byte position of the packet in the container or -1 if unknown
+       */
+      int64_t position(const size_t index) const;
+      int32_t packetSize(const size_t index) const;
+      bool isKeyframe(const size_t index) const;
+
+      /**
+       * @brief Total size in bytes of all indexed packets
+       */
+      int64_t totalSize() const noexcept;
+
+      /**
+       * @brief Presentation length of the indexed packets in stream timebase units
+       * @return >= 0
+       */
+      int64_t duration() const noexcept;
+
+      /**
+       * @brief       Find the last keyframe in decode order that is presented at or before a timestamp
+       * @param pts   Presentation timestamp in stream timebase units
+       * @return      Index of the keyframe entry if found
+       */
+      std::optional<size_t> keyframeBefore(const int64_t pts) const;
+
+      /**
+       * @brief       Find the first keyframe that is presented at or after a timestamp
+       * @param pts   Presentation timestamp in stream timebase units
+       * @return      Index of the keyframe entry if found
+       */
+      std::optional<size_t> keyframeAfter(const int64_t pts) const;
+
+      /**
+       * @brief       Count the packets that have to be decoded from a keyframe to present a timestamp
+       * @param key   Index of the keyframe entry decoding starts from
+       * @param pts   Presentation timestamp in stream timebase units
+       * @return      Number of packets from the keyframe (inclusive) to the last one presented at or before pts
+       */
+      size_t packetsUntil(const size_t key, const int64_t pts) const;
+
+    private:
+      std::vector<int64_t> pts_;
+      std::vector<int64_t> dts_;
+      std::vector<int64_t> pos_;
+      std::vector<int64_t> duration_;
+      std::vector<int32_t> size_;
+      /**
+       * @brief Entry indexes of the keyframes in decode order
+       */
+      std::vector<size_t> keyframes_;
+      int64_t total_size_ {0};
+  };
+}
+
+#endif // FFMPEGPACKETINDEX_H
@@ -0,0 +1,177 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ffmpegpacketpool.h"
+
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <new>
+#include <vector>
+
+using media_handling::ffmpeg::FFMpegPacketPool;
+namespace mft = media_handling::ffmpeg::types;
+
+
+struct FFMpegPacketPool::State
+{
+    ~State()
+    {
+      for (auto pkt : packets_) {
+        av_packet_free(&pkt);
+      }
+      for (auto block : blocks_) {
+        ::operator delete(block);
+      }
+    }
+
+    AVPacket* acquirePacket()
+    {
+      {
+        std::lock_guard lock(mutex_);
+        if (!packets_.empty()) {
+          auto pkt = packets_.back();
+          packets_.pop_back();
+          return pkt;
+        }
+      }
+      ++allocations_;
+      return av_packet_alloc();
+    }
+
+    void releasePacket(AVPacket* pkt)
+    {
+      av_packet_unref(pkt);
+      std::lock_guard lock(mutex_);
+      packets_.push_back(pkt);
+    }
+
+    void* acquireBlock(const size_t size)
+    {
+      {
+        std::lock_guard lock(mutex_);
+        if (block_size_ == 0) {
+          // Only ever the one control block type is allocated
+          block_size_ = size;
+        }
+        if ( (size == block_size_) && !blocks_.empty()) {
+          auto block = blocks_.back();
+          blocks_.pop_back();
+          return block;
+        }
+      }
+      ++allocations_;
+      return ::operator new(size);
+    }
+
+    void releaseBlock(void* block, const size_t size)
+    {
+      {
+        std::lock_guard lock(mutex_);
+        if (size == block_size_) {
+          blocks_.push_back(block);
+          return;
+        }
+      }
+      ::operator delete(block);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<AVPacket*> packets_;
+    std::vector<void*> blocks_;
+    size_t block_size_ {0};
+    std::atomic<int64_t> allocations_ {0};
+};
+
+
+/**
+ * @brief Allocates the shared_ptr control blocks of the pool's packets from its free-list
+ */
+template <typename T>
+struct FFMpegPacketPool::Allocator
+{
+    using value_type = T;
+
+    explicit Allocator(std::shared_ptr<State> state) noexcept : state_(std::move(state)) {}
+    template <typename U>
+    Allocator(const Allocator<U>& other) noexcept : state_(other.state_) {}
+
+    T* allocate(const size_t count)
+    {
+      return static_cast<T*>(state_->acquireBlock(count * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, const size_t count) noexcept
+    {
+      state_->releaseBlock(ptr, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const Allocator<U>& rhs) const noexcept
+    {
+      return state_ == rhs.state_;
+    }
+
+    template <typename U>
+    bool operator!=(const Allocator<U>& rhs) const noexcept
+    {
+      return !(*this == rhs);
+    }
+
+    std::shared_ptr<State> state_;
+};
+
+
+FFMpegPacketPool::FFMpegPacketPool() : state_(std::make_shared<State>())
+{
+}
+
+
+mft::AVPacketPtr FFMpegPacketPool::acquire()
+{
+  auto pkt = state_->acquirePacket();
+  if (pkt == nullptr) {
+    return nullptr;
+  }
+  // The deleter keeps the pool's state alive for packets outliving the pool
+  return mft::AVPacketPtr(pkt,
+                          [state = state_] (AVPacket* released) { state->releasePacket(released); },
+                          Allocator<AVPacket>(state_));
+}
+
+
+int64_t FFMpegPacketPool::allocations() const noexcept
+{
+  return state_->allocations_;
+}
+
+
+size_t FFMpegPacketPool::available() const
+{
+  std::lock_guard lock(state_->mutex_);
+  return state_->packets_.size();
+}
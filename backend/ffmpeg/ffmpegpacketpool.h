@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FFMPEGPACKETPOOL_H
+#define FFMPEGPACKETPOOL_H
+
+#include <memory>
+#include <cstdint>
+
+#include "ffmpegtypes.h"
+
+namespace media_handling::ffmpeg
+{
+  /**
+   * @brief A free-list of AVPackets for the demuxer, so reading packets does not allocate once warmed up
+   * @note  Both the AVPacket and the shared_ptr control block are recycled. Packets may be released from any thread
+   *        and may outlive the pool
+   */
+  class FFMpegPacketPool
+  {
+    public:
+      FFMpegPacketPool();
+
+      /**
+       * @brief Retrieve an empty packet, which is returned to the pool when the last reference to it is dropped
+       */
+      types::AVPacketPtr acquire();
+
+      /**
+       * @brief The number of heap allocations made by the pool (packets and control blocks)
+       */
+      int64_t allocations() const noexcept;
+
+      /**
+       * @brief The number of packets ready for reuse
+       */
+      size_t available() const;
+
+    private:
+      struct State;
+      template <typename T>
+      struct Allocator;
+      std::shared_ptr<State> state_;
+  };
+}
+
+#endif // FFMPEGPACKETPOOL_H
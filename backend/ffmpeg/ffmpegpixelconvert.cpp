@@ -0,0 +1,473 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ffmpegpixelconvert.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MH_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+// Lets a single translation unit hold every instruction set, with the choice between them made at runtime
+#define MH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MH_TARGET(isa)
+#endif
+
+using media_handling::ffmpeg::FFMpegPixelConversion;
+using media_handling::ffmpeg::SimdLevel;
+
+namespace
+{
+  using Coefficients = FFMpegPixelConversion::Coefficients;
+  using RowFunction = FFMpegPixelConversion::RowFunction;
+
+  constexpr auto FRACTION_BITS = 16;
+
+  constexpr int32_t fixedPoint(const double value)
+  {
+    return static_cast<int32_t>(value * (1 << FRACTION_BITS) + 0.5);
+  }
+
+  // BT.601, with limited-range luma scaled from 219 steps, and chroma from 224, to 255
+  constexpr double LIMITED_LUMA = 255.0 / 219.0;
+  constexpr double LIMITED_CHROMA = 255.0 / 224.0;
+
+  constexpr Coefficients BT601_LIMITED_8 {16, 128, fixedPoint(LIMITED_LUMA), fixedPoint(1.402 * LIMITED_CHROMA),
+        fixedPoint(0.344136 * LIMITED_CHROMA), fixedPoint(0.714136 * LIMITED_CHROMA),
+        fixedPoint(1.772 * LIMITED_CHROMA), FRACTION_BITS, 0xFF};
+  constexpr Coefficients BT601_FULL_8 {0, 128, fixedPoint(1.0), fixedPoint(1.402), fixedPoint(0.344136),
+        fixedPoint(0.714136), fixedPoint(1.772), FRACTION_BITS, 0xFF};
+  // Same multipliers, with the 2 extra bits of the samples shifted out of the result
+  constexpr Coefficients BT601_LIMITED_10 {64, 512, BT601_LIMITED_8.luma_, BT601_LIMITED_8.red_v_,
+        BT601_LIMITED_8.green_u_, BT601_LIMITED_8.green_v_, BT601_LIMITED_8.blue_u_, FRACTION_BITS + 2, 0x3FF};
+
+  template <typename V, typename T>
+  V loadBytes(const T* src)
+  {
+    V value;
+    std::memcpy(&value, src, sizeof(V));
+    return value;
+  }
+
+  /**
+   * @brief The scalar reference, which every vectorised row finishes its tail with
+   */
+  template <typename T, int CHANNELS>
+  void convertPixels(const T* y, const T* u, const T* v, uint8_t* dst, const int start, const int end,
+                     const Coefficients& c)
+  {
+    const int32_t round = 1 << (c.shift_ - 1);
+    const auto clamp = [] (const int32_t value) {
+      return static_cast<uint8_t>(std::clamp(value, 0, 255));
+    };
+    for (auto x = start; x < end; ++x) {
+      const int32_t luma = ((y[x] & c.sample_mask_) - c.luma_offset_) * c.luma_ + round;
+      const int32_t cu = (u[x >> 1] & c.sample_mask_) - c.chroma_offset_;
+      const int32_t cv = (v[x >> 1] & c.sample_mask_) - c.chroma_offset_;
+      uint8_t* pixel = dst + static_cast<ptrdiff_t>(x) * CHANNELS;
+      pixel[0] = clamp((luma + c.red_v_ * cv) >> c.shift_);
+      pixel[1] = clamp((luma - (c.green_u_ * cu + c.green_v_ * cv)) >> c.shift_);
+      pixel[2] = clamp((luma + c.blue_u_ * cu) >> c.shift_);
+      if constexpr (CHANNELS == 4) {
+        pixel[3] = 0xFF;
+      }
+    }
+  }
+
+  template <typename T, int CHANNELS>
+  void rowScalar(const void* y, const void* u, const void* v, uint8_t* dst, const int width, const Coefficients& c)
+  {
+    convertPixels<T, CHANNELS>(static_cast<const T*>(y), static_cast<const T*>(u), static_cast<const T*>(v), dst, 0,
+                               width, c);
+  }
+
+#ifdef MH_X86
+  // Each vectorised row widens the samples to 32-bit lanes and does the scalar arithmetic exactly, so that every
+  // instruction set matches the reference. The clamped channels are combined into RGBA pixels, with RGB24 packed from
+  // those by a byte shuffle.
+  constexpr auto ALPHA = static_cast<int32_t>(0xFF000000U);
+
+  template <typename T, int CHANNELS>
+  MH_TARGET("sse4.1")
+  void rowSse4(const void* y_data, const void* u_data, const void* v_data, uint8_t* dst, const int width,
+               const Coefficients& c)
+  {
+    const auto y = static_cast<const T*>(y_data);
+    const auto u = static_cast<const T*>(u_data);
+    const auto v = static_cast<const T*>(v_data);
+    const __m128i mask = _mm_set1_epi32(c.sample_mask_);
+    const __m128i luma_offset = _mm_set1_epi32(c.luma_offset_);
+    const __m128i chroma_offset = _mm_set1_epi32(c.chroma_offset_);
+    const __m128i luma_mul = _mm_set1_epi32(c.luma_);
+    const __m128i red_v = _mm_set1_epi32(c.red_v_);
+    const __m128i green_u = _mm_set1_epi32(c.green_u_);
+    const __m128i green_v = _mm_set1_epi32(c.green_v_);
+    const __m128i blue_u = _mm_set1_epi32(c.blue_u_);
+    const __m128i round = _mm_set1_epi32(1 << (c.shift_ - 1));
+    const __m128i shift = _mm_cvtsi32_si128(c.shift_);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi32(0xFF);
+    const __m128i alpha = _mm_set1_epi32(ALPHA);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    constexpr int STEP = 4;
+    int x = 0;
+    for (; x + STEP <= width; x += STEP) {
+      __m128i luma;
+      __m128i cu;
+      __m128i cv;
+      if constexpr (sizeof(T) == 1) {
+        luma = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(loadBytes<int32_t>(y + x)));
+        cu = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(loadBytes<uint16_t>(u + x / 2)));
+        cv = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(loadBytes<uint16_t>(v + x / 2)));
+      } else {
+        luma = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)));
+        cu = _mm_cvtepu16_epi32(_mm_cvtsi32_si128(loadBytes<int32_t>(u + x / 2)));
+        cv = _mm_cvtepu16_epi32(_mm_cvtsi32_si128(loadBytes<int32_t>(v + x / 2)));
+      }
+      // Each chroma sample covers 2 pixels
+      cu = _mm_unpacklo_epi32(cu, cu);
+      cv = _mm_unpacklo_epi32(cv, cv);
+      luma = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(_mm_and_si128(luma, mask), luma_offset), luma_mul), round);
+      cu = _mm_sub_epi32(_mm_and_si128(cu, mask), chroma_offset);
+      cv = _mm_sub_epi32(_mm_and_si128(cv, mask), chroma_offset);
+      __m128i r = _mm_sra_epi32(_mm_add_epi32(luma, _mm_mullo_epi32(cv, red_v)), shift);
+      __m128i g = _mm_sra_epi32(_mm_sub_epi32(luma, _mm_add_epi32(_mm_mullo_epi32(cu, green_u),
+                                                                   _mm_mullo_epi32(cv, green_v))), shift);
+      __m128i b = _mm_sra_epi32(_mm_add_epi32(luma, _mm_mullo_epi32(cu, blue_u)), shift);
+      r = _mm_min_epi32(_mm_max_epi32(r, zero), max);
+      g = _mm_min_epi32(_mm_max_epi32(g, zero), max);
+      b = _mm_min_epi32(_mm_max_epi32(b, zero), max);
+      const __m128i pixels = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+                                          _mm_or_si128(_mm_slli_epi32(b, 16), alpha));
+      uint8_t* out = dst + static_cast<ptrdiff_t>(x) * CHANNELS;
+      if constexpr (CHANNELS == 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pixels);
+      } else {
+        const __m128i packed = _mm_shuffle_epi8(pixels, pack);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), packed);
+        const int32_t last = _mm_extract_epi32(packed, 2);
+        std::memcpy(out + 8, &last, sizeof(last));
+      }
+    }
+    convertPixels<T, CHANNELS>(y, u, v, dst, x, width, c);
+  }
+
+  template <typename T, int CHANNELS>
+  MH_TARGET("avx2")
+  void rowAvx2(const void* y_data, const void* u_data, const void* v_data, uint8_t* dst, const int width,
+               const Coefficients& c)
+  {
+    const auto y = static_cast<const T*>(y_data);
+    const auto u = static_cast<const T*>(u_data);
+    const auto v = static_cast<const T*>(v_data);
+    const __m256i mask = _mm256_set1_epi32(c.sample_mask_);
+    const __m256i luma_offset = _mm256_set1_epi32(c.luma_offset_);
+    const __m256i chroma_offset = _mm256_set1_epi32(c.chroma_offset_);
+    const __m256i luma_mul = _mm256_set1_epi32(c.luma_);
+    const __m256i red_v = _mm256_set1_epi32(c.red_v_);
+    const __m256i green_u = _mm256_set1_epi32(c.green_u_);
+    const __m256i green_v = _mm256_set1_epi32(c.green_v_);
+    const __m256i blue_u = _mm256_set1_epi32(c.blue_u_);
+    const __m256i round = _mm256_set1_epi32(1 << (c.shift_ - 1));
+    const __m128i shift = _mm_cvtsi32_si128(c.shift_);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi32(0xFF);
+    const __m256i alpha = _mm256_set1_epi32(ALPHA);
+    const __m256i duplicate = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    constexpr int STEP = 8;
+    int x = 0;
+    for (; x + STEP <= width; x += STEP) {
+      __m256i luma;
+      __m256i cu;
+      __m256i cv;
+      if constexpr (sizeof(T) == 1) {
+        luma = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)));
+        cu = _mm256_cvtepu8_epi32(_mm_cvtsi32_si128(loadBytes<int32_t>(u + x / 2)));
+        cv = _mm256_cvtepu8_epi32(_mm_cvtsi32_si128(loadBytes<int32_t>(v + x / 2)));
+      } else {
+        luma = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)));
+        cu = _mm256_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)));
+        cv = _mm256_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)));
+      }
+      cu = _mm256_permutevar8x32_epi32(cu, duplicate);
+      cv = _mm256_permutevar8x32_epi32(cv, duplicate);
+      luma = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(_mm256_and_si256(luma, mask), luma_offset),
+                                                 luma_mul), round);
+      cu = _mm256_sub_epi32(_mm256_and_si256(cu, mask), chroma_offset);
+      cv = _mm256_sub_epi32(_mm256_and_si256(cv, mask), chroma_offset);
+      __m256i r = _mm256_sra_epi32(_mm256_add_epi32(luma, _mm256_mullo_epi32(cv, red_v)), shift);
+      __m256i g = _mm256_sra_epi32(_mm256_sub_epi32(luma, _mm256_add_epi32(_mm256_mullo_epi32(cu, green_u),
+                                                                            _mm256_mullo_epi32(cv, green_v))), shift);
+      __m256i b = _mm256_sra_epi32(_mm256_add_epi32(luma, _mm256_mullo_epi32(cu, blue_u)), shift);
+      r = _mm256_min_epi32(_mm256_max_epi32(r, zero), max);
+      g = _mm256_min_epi32(_mm256_max_epi32(g, zero), max);
+      b = _mm256_min_epi32(_mm256_max_epi32(b, zero), max);
+      const __m256i pixels = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+                                             _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha));
+      uint8_t* out = dst + static_cast<ptrdiff_t>(x) * CHANNELS;
+      if constexpr (CHANNELS == 4) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pixels);
+      } else {
+        // 12 bytes at the start of each lane, then joined as 24
+        const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, pack), join);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm256_extracti128_si256(packed, 1));
+      }
+    }
+    convertPixels<T, CHANNELS>(y, u, v, dst, x, width, c);
+  }
+
+  template <typename T, int CHANNELS>
+  MH_TARGET("avx512f,avx512bw")
+  void rowAvx512(const void* y_data, const void* u_data, const void* v_data, uint8_t* dst, const int width,
+                 const Coefficients& c)
+  {
+    const auto y = static_cast<const T*>(y_data);
+    const auto u = static_cast<const T*>(u_data);
+    const auto v = static_cast<const T*>(v_data);
+    const __m512i mask = _mm512_set1_epi32(c.sample_mask_);
+    const __m512i luma_offset = _mm512_set1_epi32(c.luma_offset_);
+    const __m512i chroma_offset = _mm512_set1_epi32(c.chroma_offset_);
+    const __m512i luma_mul = _mm512_set1_epi32(c.luma_);
+    const __m512i red_v = _mm512_set1_epi32(c.red_v_);
+    const __m512i green_u = _mm512_set1_epi32(c.green_u_);
+    const __m512i green_v = _mm512_set1_epi32(c.green_v_);
+    const __m512i blue_u = _mm512_set1_epi32(c.blue_u_);
+    const __m512i round = _mm512_set1_epi32(1 << (c.shift_ - 1));
+    const __m128i shift = _mm_cvtsi32_si128(c.shift_);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi32(0xFF);
+    const __m512i alpha = _mm512_set1_epi32(ALPHA);
+    const __m512i duplicate = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+    const __m512i pack = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                                              -1, -1, -1, -1));
+    const __m512i join = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15);
+    // The 48 bytes of 16 RGB24 pixels
+    constexpr __mmask16 RGB24_STORE = 0x0FFF;
+    constexpr int STEP = 16;
+    int x = 0;
+    for (; x + STEP <= width; x += STEP) {
+      __m512i luma;
+      __m512i cu;
+      __m512i cv;
+      if constexpr (sizeof(T) == 1) {
+        luma = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)));
+        cu = _mm512_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)));
+        cv = _mm512_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)));
+      } else {
+        luma = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x)));
+        cu = _mm512_cvtepu16_epi32(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x / 2))));
+        cv = _mm512_cvtepu16_epi32(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x / 2))));
+      }
+      cu = _mm512_permutexvar_epi32(duplicate, cu);
+      cv = _mm512_permutexvar_epi32(duplicate, cv);
+      luma = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_sub_epi32(_mm512_and_si512(luma, mask), luma_offset),
+                                                 luma_mul), round);
+      cu = _mm512_sub_epi32(_mm512_and_si512(cu, mask), chroma_offset);
+      cv = _mm512_sub_epi32(_mm512_and_si512(cv, mask), chroma_offset);
+      __m512i r = _mm512_sra_epi32(_mm512_add_epi32(luma, _mm512_mullo_epi32(cv, red_v)), shift);
+      __m512i g = _mm512_sra_epi32(_mm512_sub_epi32(luma, _mm512_add_epi32(_mm512_mullo_epi32(cu, green_u),
+                                                                            _mm512_mullo_epi32(cv, green_v))), shift);
+      __m512i b = _mm512_sra_epi32(_mm512_add_epi32(luma, _mm512_mullo_epi32(cu, blue_u)), shift);
+      r = _mm512_min_epi32(_mm512_max_epi32(r, zero), max);
+      g = _mm512_min_epi32(_mm512_max_epi32(g, zero), max);
+      b = _mm512_min_epi32(_mm512_max_epi32(b, zero), max);
+      const __m512i pixels = _mm512_or_si512(_mm512_or_si512(r, _mm512_slli_epi32(g, 8)),
+                                             _mm512_or_si512(_mm512_slli_epi32(b, 16), alpha));
+      uint8_t* out = dst + static_cast<ptrdiff_t>(x) * CHANNELS;
+      if constexpr (CHANNELS == 4) {
+        _mm512_storeu_si512(out, pixels);
+      } else {
+        const __m512i packed = _mm512_permutexvar_epi32(join, _mm512_shuffle_epi8(pixels, pack));
+        _mm512_mask_storeu_epi32(out, RGB24_STORE, packed);
+      }
+    }
+    convertPixels<T, CHANNELS>(y, u, v, dst, x, width, c);
+  }
+#endif
+
+  constexpr auto LEVELS = static_cast<size_t>(SimdLevel::AVX512) + 1;
+  using Rows = std::array<RowFunction, LEVELS>;
+
+  template <typename T, int CHANNELS>
+  const Rows ROWS {
+#ifdef MH_X86
+    rowScalar<T, CHANNELS>, rowSse4<T, CHANNELS>, rowAvx2<T, CHANNELS>, rowAvx512<T, CHANNELS>
+#else
+    rowScalar<T, CHANNELS>, rowScalar<T, CHANNELS>, rowScalar<T, CHANNELS>, rowScalar<T, CHANNELS>
+#endif
+  };
+
+  struct Conversion
+  {
+      AVPixelFormat src_;
+      AVPixelFormat dst_;
+      const Coefficients* coeffs_;
+      int chroma_shift_;
+      const Rows* rows_;
+  };
+
+  const std::array<Conversion, 12> CONVERSIONS {{
+      {AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA, &BT601_LIMITED_8, 1, &ROWS<uint8_t, 4>},
+      {AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGB24, &BT601_LIMITED_8, 1, &ROWS<uint8_t, 3>},
+      {AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_RGBA, &BT601_FULL_8, 1, &ROWS<uint8_t, 4>},
+      {AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_RGB24, &BT601_FULL_8, 1, &ROWS<uint8_t, 3>},
+      {AV_PIX_FMT_YUV422P, AV_PIX_FMT_RGBA, &BT601_LIMITED_8, 0, &ROWS<uint8_t, 4>},
+      {AV_PIX_FMT_YUV422P, AV_PIX_FMT_RGB24, &BT601_LIMITED_8, 0, &ROWS<uint8_t, 3>},
+      {AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_RGBA, &BT601_FULL_8, 0, &ROWS<uint8_t, 4>},
+      {AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_RGB24, &BT601_FULL_8, 0, &ROWS<uint8_t, 3>},
+      {AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_RGBA, &BT601_LIMITED_10, 1, &ROWS<uint16_t, 4>},
+      {AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_RGB24, &BT601_LIMITED_10, 1, &ROWS<uint16_t, 3>},
+      {AV_PIX_FMT_YUV422P10LE, AV_PIX_FMT_RGBA, &BT601_LIMITED_10, 0, &ROWS<uint16_t, 4>},
+      {AV_PIX_FMT_YUV422P10LE, AV_PIX_FMT_RGB24, &BT601_LIMITED_10, 0, &ROWS<uint16_t, 3>},
+    }};
+
+  SimdLevel detect() noexcept
+  {
+#if defined(MH_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+      return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return SimdLevel::SSE4;
+    }
+#elif defined(MH_X86) && defined(_MSC_VER)
+    std::array<int, 4> info {};
+    __cpuid(info.data(), 0);
+    const auto max_leaf = info[0];
+    __cpuid(info.data(), 1);
+    const bool sse4 = (info[2] & (1 << 19)) != 0;
+    // The OS has to save the wider registers too
+    const bool os_save = (info[2] & (1 << 27)) != 0;
+    const auto xcr0 = os_save ? _xgetbv(0) : 0;
+    bool avx2 = false;
+    bool avx512 = false;
+    if (max_leaf >= 7) {
+      __cpuidex(info.data(), 7, 0);
+      avx2 = ((info[1] & (1 << 5)) != 0) && ((xcr0 & 0x6) == 0x6);
+      avx512 = ((info[1] & (1 << 16)) != 0) && ((info[1] & (1 << 30)) != 0) && ((xcr0 & 0xE6) == 0xE6);
+    }
+    if (avx512) {
+      return SimdLevel::AVX512;
+    }
+    if (avx2) {
+      return SimdLevel::AVX2;
+    }
+    if (sse4) {
+      return SimdLevel::SSE4;
+    }
+#endif
+    return SimdLevel::SCALAR;
+  }
+}
+
+
+SimdLevel media_handling::ffmpeg::detectSimdLevel() noexcept
+{
+  static const SimdLevel level = detect();
+  return level;
+}
+
+
+std::optional<FFMpegPixelConversion> FFMpegPixelConversion::find(const AVPixelFormat src, const AVPixelFormat dst,
+                                                                 std::optional<SimdLevel> level) noexcept
+{
+  const auto conversion = std::find_if(CONVERSIONS.begin(), CONVERSIONS.end(), [&] (const Conversion& conv) {
+    return (conv.src_ == src) && (conv.dst_ == dst);
+  });
+  if (conversion == CONVERSIONS.end()) {
+    return {};
+  }
+  FFMpegPixelConversion result;
+  result.src_fmt_ = src;
+  result.dst_fmt_ = dst;
+  // Never wider than this CPU supports
+  result.level_ = std::min(level.value_or(SimdLevel::AVX512), detectSimdLevel());
+  result.row_ = (*conversion->rows_)[static_cast<size_t>(result.level_)];
+  result.coeffs_ = conversion->coeffs_;
+  result.chroma_shift_ = conversion->chroma_shift_;
+  return result;
+}
+
+
+void FFMpegPixelConversion::convert(const AVFrame& src, AVFrame& dst, const int y, const int height) const noexcept
+{
+  for (auto row = y; row < (y + height); ++row) {
+    const auto chroma_row = static_cast<ptrdiff_t>(row >> chroma_shift_);
+    row_(src.data[0] + static_cast<ptrdiff_t>(row) * src.linesize[0],
+         src.data[1] + chroma_row * src.linesize[1],
+         src.data[2] + chroma_row * src.linesize[2],
+         dst.data[0] + static_cast<ptrdiff_t>(row) * dst.linesize[0],
+         src.width,
+         *coeffs_);
+  }
+}
+
+
+bool FFMpegPixelConversion::convert(const AVFrame& src, AVFrame& dst) const noexcept
+{
+  if ( (src.format != src_fmt_) || (dst.format != dst_fmt_) || (src.width != dst.width) || (src.height != dst.height)
+       || (src.data[0] == nullptr) || (dst.data[0] == nullptr) ) {
+    return false;
+  }
+  convert(src, dst, 0, src.height);
+  return true;
+}
+
+
+AVPixelFormat FFMpegPixelConversion::source() const noexcept
+{
+  return src_fmt_;
+}
+
+
+AVPixelFormat FFMpegPixelConversion::destination() const noexcept
+{
+  return dst_fmt_;
+}
+
+
+SimdLevel FFMpegPixelConversion::level() const noexcept
+{
+  return level_;
+}
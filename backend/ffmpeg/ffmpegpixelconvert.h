@@ -0,0 +1,130 @@
+/*
+  Copyright (c) 2019, Jonathan Noble
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FFMPEGPIXELCONVERT_H
+#define FFMPEGPIXELCONVERT_H
+
+#include <cstdint>
+#include <optional>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+namespace media_handling::ffmpeg
+{
+  /**
+   * @brief Instruction sets a pixel conversion is vectorised with, in increasing width
+   */
+  enum class SimdLevel
+  {
+    SCALAR,
+    SSE4,
+    AVX2,
+    AVX512
+  };
+
+  /**
+   * @brief The widest instruction set this CPU, and its OS, supports
+   */
+  SimdLevel detectSimdLevel() noexcept;
+
+  /**
+   * @brief An unscaled YUV to RGB conversion, vectorised by hand, used in place of swscale for the most common formats
+   * @note  Uses BT.601 coefficients and nearest chroma samples, as swscale does for an unscaled conversion by default.
+   *        Every instruction set produces the same output as the scalar reference
+   */
+  class FFMpegPixelConversion
+  {
+    public:
+      /**
+       * @brief         Find the conversion between two pixel formats
+       * @param src     Format of the decoded frames
+       * @param dst     Format of the converted output
+       * @param level   The widest instruction set to use, or that of this CPU if unset
+       * @return        conversion or nothing if there isn't one for the formats
+       */
+      static std::optional<FFMpegPixelConversion> find(const AVPixelFormat src, const AVPixelFormat dst,
+                                                       std::optional<SimdLevel> level = {}) noexcept;
+
+      /**
+       * @brief         Convert rows of a frame
+       * @note          The first row has to be on a whole chroma row
+       * @param src     Frame of the source format
+       * @param dst     Frame of the output format, of the same dimensions as src
+       * @param y       First row to convert
+       * @param height  Number of rows to convert
+       */
+      void convert(const AVFrame& src, AVFrame& dst, const int y, const int height) const noexcept;
+      /**
+       * @brief     Convert a whole frame
+       * @return    true==converted
+       */
+      bool convert(const AVFrame& src, AVFrame& dst) const noexcept;
+
+      AVPixelFormat source() const noexcept;
+      AVPixelFormat destination() const noexcept;
+      SimdLevel level() const noexcept;
+
+      /**
+       * @brief Fixed-point form of a YUV to RGB matrix
+       */
+      struct Coefficients
+      {
+          int32_t luma_offset_;
+          int32_t chroma_offset_;
+          int32_t luma_;
+          int32_t red_v_;
+          int32_t green_u_;
+          int32_t green_v_;
+          int32_t blue_u_;
+          int32_t shift_;
+          /**
+           * @brief Mask of the valid bits of a sample
+           */
+          int32_t sample_mask_;
+      };
+      using RowFunction = void (*)(const void* y, const void* u, const void* v, uint8_t* dst, const int width,
+                                   const Coefficients& coeffs);
+
+    private:
+      FFMpegPixelConversion() = default;
+
+      AVPixelFormat src_fmt_ {AV_PIX_FMT_NONE};
+      AVPixelFormat dst_fmt_ {AV_PIX_FMT_NONE};
+      SimdLevel level_ {SimdLevel::SCALAR};
+      RowFunction row_ {nullptr};
+      const Coefficients* coeffs_ {nullptr};
+      /**
+       * @brief log2 of the vertical chroma subsampling
+       */
+      int chroma_shift_ {0};
+  };
+}
+
+#endif // FFMPEGPIXELCONVERT_H
@@ -28,6 +28,7 @@
 #include "ffmpegsink.h"
 
 #include <filesystem>
+#include <tuple>
 
 #include "mediahandling.h"
 #include "ffmpegstream.h"
@@ -40,7 +41,7 @@ constexpr size_t ERR_LEN = 256;
 
 namespace
 {
-  std::string err(ERR_LEN, '\0');
+  thread_local std::string err(ERR_LEN, '\0');
 }
 
 FFMpegSink::FFMpegSink(std::string file_path, std::vector<Codec> video_codecs, std::vector<Codec> audio_codecs)
@@ -127,11 +128,67 @@ bool FFMpegSink::initialise()
     }
   }
 
+  const auto encoders = streams_.audio_.size() + streams_.video_.size();
+  for (const auto& copy : copies_) {
+    try {
+      auto stream = std::make_shared<FFMpegStream>(this, *copy.parameters_, copy.time_base_);
+      auto& av_stream = *stream->avStream();
+      av_stream.avg_frame_rate = copy.frame_rate_;
+      av_stream.sample_aspect_ratio = copy.sample_aspect_ratio_;
+      if ( (copy.parameters_->codec_type == AVMEDIA_TYPE_VIDEO) && (copy.frame_rate_.num > 0) ) {
+        // As for an encoder, so that muxers limited to frame rate time bases (i.e. MXF) accept it
+        av_stream.time_base = av_inv_q(copy.frame_rate_);
+      }
+      if (copy.parameters_->codec_type == AVMEDIA_TYPE_AUDIO) {
+        streams_.audio_.emplace_back(std::move(stream));
+      } else {
+        streams_.video_.emplace_back(std::move(stream));
+      }
+    } catch (const std::runtime_error& ex) {
+      LCRITICAL(ex.what());
+      return false;
+    }
+  }
+  copies_.clear();
+
   if (streams_.audio_.empty() && streams_.video_.empty()) {
     LCRITICAL("Failed to setup any streams");
     return false;
   }
+  bool is_valid = false;
+  const auto queue_size = this->property<int32_t>(MediaProperty::ENCODE_QUEUE_SIZE, is_valid);
+  mux_.asynchronous_ = is_valid && (queue_size > 0);
+  pending_encoders_ = encoders;
   ready_ = true;
+  if (encoders == 0) {
+    // Only copying, so every stream's parameters are already known
+    return writeHeader();
+  }
+  return true;
+}
+
+
+bool FFMpegSink::addCopyStream(const AVStream& source)
+{
+  if (ready_) {
+    LWARNING("Cannot add streams once Sink has been initialised");
+    return false;
+  }
+  const auto type = source.codecpar != nullptr ? source.codecpar->codec_type : AVMEDIA_TYPE_UNKNOWN;
+  if ( (type != AVMEDIA_TYPE_VIDEO) && (type != AVMEDIA_TYPE_AUDIO) ) {
+    LWARNING("Only video and audio streams can be copied");
+    return false;
+  }
+  CopySource copy;
+  copy.parameters_.reset(avcodec_parameters_alloc());
+  if ( (copy.parameters_ == nullptr) || (avcodec_parameters_copy(copy.parameters_.get(), source.codecpar) < 0) ) {
+    LCRITICAL("Failed to copy the codec parameters of the source stream");
+    return false;
+  }
+  copy.time_base_ = source.time_base;
+  copy.frame_rate_ = source.avg_frame_rate;
+  copy.sample_aspect_ratio_ = source.sample_aspect_ratio;
+  copies_.emplace_back(std::move(copy));
   return true;
 }
 
@@ -202,25 +259,63 @@ AVFormatContext& FFMpegSink::formatContext() const
 
 bool FFMpegSink::writeHeader()
 {
-  bool okay = true;
-  if (!header_written_) {
-      auto ret = avformat_write_header(fmt_ctx_.get(), nullptr);
-      if (ret < 0) {
-        av_strerror(ret, err.data(), ERR_LEN);
-        const auto msg = fmt::format("Could not write output file header, msg=", err.data());
-        LWARNING(msg);
-        okay = false;
-      } else {
-        header_written_ = true;
-      }
+  {
+    std::lock_guard lock(mux_.mutex_);
+    if (mux_.header_written_) {
+      return true;
+    }
+    if (fmt_ctx_ == nullptr) {
+      return false;
+    }
+    // No packet is written until the header is, so nothing else is using the context
+    auto ret = avformat_write_header(fmt_ctx_.get(), nullptr);
+    if (ret < 0) {
+      av_strerror(ret, err.data(), ERR_LEN);
+      const auto msg = fmt::format("Could not write output file header, msg={}", err.data());
+      LWARNING(msg);
+      return false;
+    }
+    mux_.header_written_ = true;
+    if (!startMux()) {
+      return true;
+    }
   }
-  return okay;
+  muxQueued();
+  return true;
+}
+
+bool FFMpegSink::encoderReady()
+{
+  if (--pending_encoders_ > 0) {
+    return true;
+  }
+  return writeHeader();
+}
+
+bool FFMpegSink::setupEncoders()
+{
+  std::call_once(encoders_setup_, [this] {
+    // Set up together, as a caller writing one stream after another would otherwise queue all of the first stream's
+    // packets waiting for the header
+    bool okay = true;
+    for (const auto& streams : {streams_.video_, streams_.audio_}) {
+      for (const auto& stream : streams) {
+        const auto ff_stream = std::dynamic_pointer_cast<FFMpegStream>(stream);
+        okay = ff_stream && ff_stream->prepareEncoder() && okay;
+      }
+    }
+    encoders_ready_ = okay && (pending_encoders_ == 0);
+  });
+  return encoders_ready_;
 }
 
 bool FFMpegSink::writeTrailer()
 {
-  if ((fmt_ctx_ == nullptr) || (!header_written_)) {
-    return false;
+  {
+    std::lock_guard lock(mux_.mutex_);
+    if ((fmt_ctx_ == nullptr) || (!mux_.header_written_)) {
+      return false;
+    }
   }
   bool okay = true;
   const auto func = [&] {
@@ -240,13 +335,95 @@ bool FFMpegSink::writeTrailer()
   return okay;
 }
 
+bool FFMpegSink::writePacket(AVPacket& packet, const AVRational time_base)
+{
+  auto queued = packet_pool_.acquire();
+  av_packet_move_ref(queued.get(), &packet);
+  {
+    std::lock_guard lock(mux_.mutex_);
+    if (mux_.failed_) {
+      return false;
+    }
+    mux_.queue_.emplace_back(std::move(queued), time_base);
+    if (!startMux()) {
+      return true;
+    }
+  }
+  muxQueued();
+  std::lock_guard lock(mux_.mutex_);
+  return !mux_.failed_;
+}
+
+
+bool FFMpegSink::startMux()
+{
+  if (!mux_.header_written_ || mux_.running_ || mux_.queue_.empty()) {
+    return false;
+  }
+  mux_.running_ = true;
+  if (mux_.asynchronous_) {
+    Executor::global()->submit([this] { muxQueued(); });
+    return false;
+  }
+  return true;
+}
+
+
+void FFMpegSink::muxQueued()
+{
+  while (true) {
+    types::AVPacketPtr packet;
+    AVRational time_base;
+    {
+      std::lock_guard lock(mux_.mutex_);
+      if (mux_.queue_.empty()) {
+        mux_.running_ = false;
+        mux_.cond_.notify_all();
+        return;
+      }
+      std::tie(packet, time_base) = std::move(mux_.queue_.front());
+      mux_.queue_.pop_front();
+    }
+    // Muxers may change a stream's time base when writing the header, so this is only known now
+    av_packet_rescale_ts(packet.get(), time_base, fmt_ctx_->streams[packet->stream_index]->time_base);
+    // Interleaving across the streams is done by the muxer, which buffers packets until it can write them in order
+    const auto ret = av_interleaved_write_frame(fmt_ctx_.get(), packet.get());
+    if (ret < 0) {
+      av_strerror(ret, err.data(), ERR_LEN);
+      LCRITICAL(fmt::format("Failed to write frame to container, msg={}", err.data()));
+      std::lock_guard lock(mux_.mutex_);
+      mux_.failed_ = true;
+      mux_.queue_.clear();
+    }
+  }
+}
+
+
+bool FFMpegSink::flush()
+{
+  bool okay = true;
+  for (const auto& streams : {streams_.video_, streams_.audio_}) {
+    for (const auto& stream : streams) {
+      okay = stream->flush() && okay;
+    }
+  }
+  std::unique_lock lock(mux_.mutex_);
+  mux_.cond_.wait(lock, [this] { return mux_.queue_.empty() && !mux_.running_; });
+  return okay && !mux_.failed_;
+}
+
+
 void FFMpegSink::finish()
 {
+  if (!flush()) {
+    LWARNING(fmt::format("Failed to write all frames, filePath={}", file_path_));
+  }
   writeTrailer();
   ready_ = false;
   fmt_ctx_.reset();
   codecs_.audio_.clear();
   codecs_.video_.clear();
+  copies_.clear();
   streams_.audio_.clear();
   streams_.video_.clear();
   file_path_.clear();
@@ -31,9 +31,12 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 
 #include "imediasink.h"
 #include "imediastream.h"
+#include "ffmpegpacketpool.h"
 #include "ffmpegtypes.h"
 
 extern "C" {
@@ -67,9 +70,57 @@ namespace media_handling::ffmpeg
       std::set<Codec> supportedAudioCodecs() const override;
       std::set<Codec> supportedVideoCodecs() const override;
     public:
+      /**
+       * @note  Not to be written to directly once any stream is writing, as the packet writer may be using it
+       */
       AVFormatContext& formatContext() const;
+      /**
+       * @brief   Write the container header, then any packets held back waiting for it
+       * @note    Thread-safe, and only writes the header once
+       * @return  true==header written
+       */
       bool writeHeader();
       bool writeTrailer();
+      /**
+       * @brief   Called by each stream once its encoder is set up, so that the header is written with every stream's
+       *          parameters
+       * @return  false if this was the last stream and writing the header failed
+       */
+      bool encoderReady();
+      /**
+       * @brief   Set up every stream's encoder, on the first write to any stream, so that the header is written
+       *          before packets queue up behind it
+       * @note    Thread-safe. Streams' properties have to be set before any stream is written to
+       * @return  true==every encoder set up and the header written
+       */
+      bool setupEncoders();
+      /**
+       * @brief             Write an encoded packet to the container
+       * @note              Thread-safe. The packet is queued, then written by whichever thread is already writing, by
+       *                    the mux task if the sink has MediaProperty::ENCODE_QUEUE_SIZE set, or else by the calling
+       *                    thread. Packets are held until the header is written
+       * @param packet      Packet with its stream index and timestamps set, whose reference is taken
+       * @param time_base   Time base of the packet's timestamps, which are rescaled to the stream's once the header has
+       *                    fixed it
+       * @return            true==written or queued
+       */
+      bool writePacket(AVPacket& packet, const AVRational time_base);
+      /**
+       * @brief         Add a stream written with the packets of a source stream as they are, instead of encoding
+       * @note          Call before initialise(), after which the stream is one of visualStreams() or audioStreams()
+       * @see           FFMpegStream::copyPacket
+       * @param source  Stream of an FFMpegSource, whose codec parameters are copied
+       * @return        true==added
+       */
+      bool addCopyStream(const AVStream& source);
+      /**
+       * @brief   Wait for every stream's queued frames to be encoded and their packets written to the container
+       * @return  false if any failed
+       */
+      bool flush();
+      /**
+       * @brief Flush, then write the trailer and close the file
+       */
       void finish();
     private:
       std::string file_path_;
@@ -77,14 +128,55 @@ namespace media_handling::ffmpeg
           std::vector<Codec> video_;
           std::vector<Codec> audio_;
       } codecs_;
+      struct CopySource
+      {
+          types::AVCodecParametersUPtr parameters_ {nullptr};
+          AVRational time_base_ {0, 1};
+          AVRational frame_rate_ {0, 1};
+          AVRational sample_aspect_ratio_ {0, 1};
+      };
+      std::vector<CopySource> copies_;
       struct {
           std::vector<MediaStreamPtr> video_;
           std::vector<MediaStreamPtr> audio_;
       } streams_;
       types::AVFormatContextUPtr fmt_ctx_ {nullptr};
-      bool header_written_;
       std::once_flag trailer_written_;
       std::atomic<bool> ready_ {false};
+      /**
+       * @brief Streams whose encoders are not yet set up. Streams copying packets have none
+       */
+      std::atomic<size_t> pending_encoders_ {0};
+      std::once_flag encoders_setup_;
+      std::atomic<bool> encoders_ready_ {false};
+      FFMpegPacketPool packet_pool_;
+      /**
+       * @brief Packets from all streams, written by one thread at a time, as the container is not thread-safe
+       */
+      struct {
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        std::deque<std::pair<types::AVPacketPtr, AVRational>> queue_;
+        bool asynchronous_ {false};
+        /**
+         * @brief A thread or task is writing the queue
+         */
+        bool running_ {false};
+        bool failed_ {false};
+        bool header_written_ {false};
+      } mux_;
+
+    private:
+      /**
+       * @brief Write the queued packets until none are left
+       */
+      void muxQueued();
+      /**
+       * @brief   Start writing the queued packets, unless a thread already is
+       * @note    mux_.mutex_ must be held
+       * @return  true==the caller has to write them, with muxQueued()
+       */
+      bool startMux();
 
   };
 }
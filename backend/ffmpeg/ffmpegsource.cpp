@@ -54,7 +54,7 @@ extern "C" {
 
 namespace
 {
-  std::string err(ERR_LEN, '\0');
+  thread_local std::string err(ERR_LEN, '\0');
 }
 
 
@@ -116,43 +116,54 @@ bool FFMpegSource::initialise()
     }
   }());
 
-  const auto p = path.c_str(); // only because path is unavailable when in debug
+  open_path_ = path;
+  sequence_start_ = start;
+  format_ctx_ = openDemuxer();
+  if (format_ctx_ == nullptr) {
+    return false;
+  }
+
+  findFrameRate();
+  // Extract properties
+  extractProperties(*format_ctx_);
+  if (format_ctx_->metadata)
+  {
+    extractMetadata(*format_ctx_->metadata);
+  }
+
+#ifdef VERBOSE_FFMPEG
+  av_dump_format(format_ctx_, 0, file_path_.c_str(), 0);
+#endif
+  return true;
+}
+
+media_handling::ffmpeg::types::AVFormatContextUPtr FFMpegSource::openDemuxer() const
+{
+  const auto p = open_path_.c_str(); // only because path is unavailable when in debug
   AVDictionary* dict = nullptr;
-  if (start > 0) {
+  if (sequence_start_ > 0) {
     // FFMpeg expects sequences to start at zero by default
-    av_dict_set(&dict, "start_number", std::to_string(start).c_str(), 0);
+    av_dict_set(&dict, "start_number", std::to_string(sequence_start_).c_str(), 0);
   }
   // Open the file
   AVFormatContext* ctx = nullptr;
   int err_code = avformat_open_input(&ctx, p, nullptr, &dict);
+  av_dict_free(&dict);
   if (err_code != 0) {
     av_strerror(err_code, err.data(), ERR_LEN);
     LCRITICAL("Failed to open file, code=" + err + "fileName=" + p);
     avformat_free_context(ctx);
-    return false;
+    return nullptr;
   }
-  format_ctx_.reset(ctx);
-  assert(format_ctx_);
+  types::AVFormatContextUPtr format_ctx(ctx);
   // Read info about the file
-  err_code = avformat_find_stream_info(format_ctx_.get(), nullptr);
+  err_code = avformat_find_stream_info(format_ctx.get(), nullptr);
   if (err_code != 0) {
     av_strerror(err_code, err.data(), ERR_LEN);
     LCRITICAL("Failed to read file info, code=" + err);
-    return false;
+    return nullptr;
   }
-
-  findFrameRate();
-  // Extract properties
-  extractProperties(*format_ctx_);
-  if (format_ctx_->metadata)
-  {
-    extractMetadata(*format_ctx_->metadata);
-  }
-
-#ifdef VERBOSE_FFMPEG
-  av_dump_format(format_ctx_, 0, file_path_.c_str(), 0);
-#endif
-  return true;
+  return format_ctx;
 }
 
 void FFMpegSource::setFilePath(const std::string& file_path)
@@ -164,21 +175,8 @@ void FFMpegSource::setFilePath(const std::string& file_path)
 
 MediaStreamPtr FFMpegSource::audioStream(const int index)
 {
-  if (format_ctx_ == nullptr) {
-    return {};
-  }
-  int streams = 0;
-  gsl::span<AVStream*> span_streams(format_ctx_->streams, format_ctx_->nb_streams);
-  for (auto& stream: span_streams) {
-    if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-      if (streams == index) {
-        auto f_s = this->newMediaStream(*stream);
-        std::dynamic_pointer_cast<FFMpegStream>(f_s)->initialise();
-        return f_s;
-      } else {
-        streams++;
-      }
-    }
+  if (auto stream = findStream(AVMEDIA_TYPE_AUDIO, index)) {
+    return sharedStream(*stream);
   }
   return {};
 }
@@ -186,72 +184,111 @@ MediaStreamPtr FFMpegSource::audioStream(const int index)
 
 MediaStreamMap FFMpegSource::audioStreams()
 {
-  int streams = 0;
-  MediaStreamMap a_m;
-  gsl::span<AVStream*> span_streams(format_ctx_->streams, format_ctx_->nb_streams);
-  for (auto& stream: span_streams) {
-    if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-      auto f_s = this->newMediaStream(*stream);
-      std::dynamic_pointer_cast<FFMpegStream>(f_s)->initialise();
-      a_m[streams++] = f_s;
-    }
-  }
-  return a_m;
+  return sharedStreams(AVMEDIA_TYPE_AUDIO);
 }
 
 
 MediaStreamPtr FFMpegSource::visualStream(const int index)
+{
+  if (auto stream = findStream(AVMEDIA_TYPE_VIDEO, index)) {
+    return sharedStream(*stream);
+  }
+  return {};
+}
+
+MediaStreamMap FFMpegSource::visualStreams()
+{
+  return sharedStreams(AVMEDIA_TYPE_VIDEO);
+}
+
+
+MediaStreamPtr FFMpegSource::newAudioStream(const int index)
+{
+  if (auto stream = findStream(AVMEDIA_TYPE_AUDIO, index)) {
+    return createStream(*stream);
+  }
+  return {};
+}
+
+
+MediaStreamPtr FFMpegSource::newVisualStream(const int index)
+{
+  if (auto stream = findStream(AVMEDIA_TYPE_VIDEO, index)) {
+    return createStream(*stream);
+  }
+  return {};
+}
+
+MediaStreamPtr FFMpegSource::newMediaStream(AVStream& stream)
+{
+  return std::make_shared<FFMpegStream>(this, &stream);
+}
+
+
+AVStream* FFMpegSource::findStream(const AVMediaType type, const int index) const
 {
   if (format_ctx_ == nullptr) {
-    return {};
+    return nullptr;
   }
   int streams = 0;
   gsl::span<AVStream*> span_streams(format_ctx_->streams, format_ctx_->nb_streams);
   for (auto& stream: span_streams) {
-    if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+    if (stream->codecpar->codec_type == type) {
       if (streams == index) {
-        auto f_s = this->newMediaStream(*stream);
-        bool is_okay;
-        const auto frate = this->property(MediaProperty::FRAME_RATE, is_okay);
-        assert(is_okay);
-        f_s->setProperty(MediaProperty::FRAME_RATE, frate);
-        std::dynamic_pointer_cast<FFMpegStream>(f_s)->initialise();
-        return f_s;
-      } else {
-        streams++;
+        return stream;
       }
+      streams++;
     }
   }
-  return {};
+  return nullptr;
 }
 
-MediaStreamMap FFMpegSource::visualStreams()
+
+MediaStreamPtr FFMpegSource::createStream(AVStream& stream)
+{
+  auto f_s = this->newMediaStream(stream);
+  if (stream.codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+    bool is_okay;
+    const auto frate = this->property(MediaProperty::FRAME_RATE, is_okay);
+    assert(is_okay);
+    f_s->setProperty(MediaProperty::FRAME_RATE, frate);
+  }
+  std::dynamic_pointer_cast<FFMpegStream>(f_s)->initialise();
+  return f_s;
+}
+
+
+MediaStreamPtr FFMpegSource::sharedStream(AVStream& stream)
+{
+  std::lock_guard lock(streams_mutex_);
+  auto& f_s = streams_[stream.index];
+  if (f_s == nullptr) {
+    f_s = createStream(stream);
+  }
+  return f_s;
+}
+
+
+MediaStreamMap FFMpegSource::sharedStreams(const AVMediaType type)
 {
-  int streams = 0;
   MediaStreamMap a_m;
+  if (format_ctx_ == nullptr) {
+    return a_m;
+  }
+  int streams = 0;
   gsl::span<AVStream*> span_streams(format_ctx_->streams, format_ctx_->nb_streams);
   for (auto& stream: span_streams) {
-    if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-      auto f_s = this->newMediaStream(*stream);
-      bool is_okay;
-      const auto frate = this->property(MediaProperty::FRAME_RATE, is_okay);
-      assert(is_okay);
-      f_s->setProperty(MediaProperty::FRAME_RATE, frate);
-      std::dynamic_pointer_cast<FFMpegStream>(f_s)->initialise();
-      a_m[streams++] = f_s;
+    if (stream->codecpar->codec_type == type) {
+      a_m[streams++] = sharedStream(*stream);
     }
   }
   return a_m;
 }
 
-MediaStreamPtr FFMpegSource::newMediaStream(AVStream& stream)
-{
-  return std::make_shared<FFMpegStream>(this, &stream);
-}
-
 
 void FFMpegSource::queueStream(const int stream_index) const
 {
+  std::lock_guard lock(packeting_.mutex_);
   if (packeting_.indexes_.count(stream_index) == 1) {
     packeting_.indexes_[stream_index]++;
   } else {
@@ -261,6 +298,7 @@ void FFMpegSource::queueStream(const int stream_index) const
 
 void FFMpegSource::unqueueStream(const int stream_index)
 {
+  std::lock_guard lock(packeting_.mutex_);
   if (packeting_.indexes_.count(stream_index) == 1) {
     packeting_.indexes_[stream_index]--;
   } else {
@@ -270,11 +308,13 @@ void FFMpegSource::unqueueStream(const int stream_index)
 
 media_handling::ffmpeg::types::AVPacketPtr FFMpegSource::nextPacket(const int stream_index)
 {
+  // Decoding happens outside of this so only reading packets is serialised between streams
+  std::lock_guard lock(packeting_.mutex_);
   // prevent unnecessary read of demuxed packets
   auto read_packet = [&] () -> media_handling::ffmpeg::types::AVPacketPtr
   {
     while (true) {
-      auto pkt = std::shared_ptr<AVPacket>(av_packet_alloc(), types::avPacketDeleter);
+      auto pkt = packeting_.pool_.acquire();
       assert(format_ctx_ && pkt);
       const auto ret = av_read_frame(format_ctx_.get(), pkt.get());
       if (ret < 0) {
@@ -285,8 +325,8 @@ media_handling::ffmpeg::types::AVPacketPtr FFMpegSource::nextPacket(const int st
       if (pkt->stream_index == stream_index) {
         return pkt;
       }
-      if ( (packeting_.indexes_.count(stream_index) == 1)
-           && (packeting_.indexes_.at(stream_index) > 0)) {
+      if ( (packeting_.indexes_.count(pkt->stream_index) == 1)
+           && (packeting_.indexes_.at(pkt->stream_index) > 0)) {
         // only queue packets for needed streams
         packeting_.queue_[pkt->stream_index].push(pkt);
       }
@@ -307,9 +347,31 @@ media_handling::ffmpeg::types::AVPacketPtr FFMpegSource::nextPacket(const int st
   }
 }
 
-void FFMpegSource::resetPacketQueue()
+void FFMpegSource::resetPacketQueue(const int stream_index)
 {
-  packeting_.queue_.clear();
+  packeting_.queue_.erase(stream_index);
+}
+
+media_handling::ffmpeg::types::AVPacketPtr FFMpegSource::allocatePacket()
+{
+  return packeting_.pool_.acquire();
+}
+
+const media_handling::ffmpeg::FFMpegPacketPool& FFMpegSource::packetPool() const noexcept
+{
+  return packeting_.pool_;
+}
+
+size_t FFMpegSource::queuedPackets(const int stream_index) const
+{
+  std::lock_guard lock(packeting_.mutex_);
+  const auto queue = packeting_.queue_.find(stream_index);
+  return queue != packeting_.queue_.end() ? queue->second.size() : 0;
+}
+
+std::unique_lock<std::mutex> FFMpegSource::lockDemuxer() const
+{
+  return std::unique_lock(packeting_.mutex_);
 }
 
 
@@ -353,6 +415,12 @@ void FFMpegSource::extractMetadata(const AVDictionary& metadata)
       LWARNING("Failed to configure start timecode");
     }
   }
+  else if (media_handling::global::lazy_stream_properties)
+  {
+    if (const auto start_tc = streamTimeCode()) {
+      this->setProperty(MediaProperty::START_TIMECODE, start_tc.value());
+    }
+  }
   else if (auto strm = this->visualStream(0))
   {
     const auto start_tc = strm->property<TimeCode>(MediaProperty::START_TIMECODE, okay);
@@ -368,16 +436,22 @@ void FFMpegSource::extractStreamProperties(AVStream** streams, const uint32_t st
   int32_t visual_count = 0;
   int32_t audio_count = 0;
 
+  // Opening a decoder per stream is expensive for sources with many streams
+  const bool probe = !media_handling::global::lazy_stream_properties;
   gsl::span<AVStream*> span_streams(streams, stream_count);
   for (auto& stream: span_streams) {
     assert(stream);
     switch (stream->codecpar->codec_type) {
       case AVMEDIA_TYPE_VIDEO:
-        FFMpegStream(this, stream); // extract any properties which may attach to source
+        if (probe) {
+          FFMpegStream(this, stream); // extract any properties which may attach to source
+        }
         visual_count++;
         break;
       case AVMEDIA_TYPE_AUDIO:
-        FFMpegStream(this, stream); // extract any properties which may attach to source
+        if (probe) {
+          FFMpegStream(this, stream); // extract any properties which may attach to source
+        }
         audio_count++;
         break;
       default:
@@ -391,6 +465,33 @@ void FFMpegSource::extractStreamProperties(AVStream** streams, const uint32_t st
 }
 
 
+std::optional<media_handling::TimeCode> FFMpegSource::streamTimeCode() const
+{
+  gsl::span<AVStream*> streams{format_ctx_->streams, format_ctx_->nb_streams};
+  for (auto& stream : streams)  {
+    assert(stream);
+    if (stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+      continue;
+    }
+    // As FFMpegStream would find it, without opening a decoder
+    if ( (stream->time_base.den <= 0) || (stream->avg_frame_rate.den == 0)) {
+      return {};
+    }
+    TimeCode tc(Rational(stream->time_base.num, stream->time_base.den),
+                Rational(stream->avg_frame_rate.num, stream->avg_frame_rate.den));
+    if (stream->metadata != nullptr) {
+      if (AVDictionaryEntry* entry = av_dict_get(stream->metadata, TAG_TIMECODE, nullptr, 0)) {
+        if (!tc.setTimeCode(std::string(entry->value))) {
+          LWARNING("Failed to configure start timecode");
+        }
+      }
+    }
+    return tc;
+  }
+  return {};
+}
+
+
 void FFMpegSource::findFrameRate()
 {
   // this is making a (reasonable) assumption that there is only ever 1 video stream
@@ -459,6 +560,11 @@ media_handling::OperationalPattern FFMpegSource::findOperationalPattern(const AV
 }
 void FFMpegSource::reset()
 {
+  {
+    // Streams refer to the format context
+    std::lock_guard lock(streams_mutex_);
+    streams_.clear();
+  }
   format_ctx_.reset();
   format_ctx_ = nullptr;
 }
@@ -30,11 +30,15 @@
 
 #include <queue>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <gsl/gsl-lite.hpp>
 
 #include "imediasource.h"
+#include "ffmpegpacketpool.h"
 #include "ffmpegstream.h"
 #include "ffmpegtypes.h"
+#include "timecode.h"
 #include "types.h"
 
 
@@ -67,14 +71,46 @@ namespace media_handling::ffmpeg
       MediaStreamMap audioStreams() final;
       MediaStreamPtr visualStream(const int index) final;
       MediaStreamMap visualStreams() final;
+    public:
+      /**
+       * @brief         Create an audio stream with its own decoder, instead of the instance shared by audioStream()
+       * @param index   Index from the available audio-streams (not index of all streams)
+       * @return        Stream on success or nullptr
+       */
+      MediaStreamPtr newAudioStream(const int index);
+      /**
+       * @brief         Create a visual stream with its own decoder, instead of the instance shared by visualStream()
+       * @param index   Index from the available visual-streams (not index of all streams)
+       * @return        Stream on success or nullptr
+       */
+      MediaStreamPtr newVisualStream(const int index);
+      /**
+       * @brief Retrieve the pool the source's packets are allocated from, for its allocation statistics
+       */
+      const FFMpegPacketPool& packetPool() const noexcept;
+      /**
+       * @brief               The number of packets of a stream read ahead by the other streams' reads
+       * @param stream_index  FFMpeg stream index
+       */
+      size_t queuedPackets(const int stream_index) const;
     protected:
       virtual MediaStreamPtr newMediaStream(AVStream& stream);
     private:
       friend class FFMpegSourceTestable;
       friend class FFMpegStream;
       std::string file_path_;
+      /**
+       * @brief The path given to the demuxer, which may be an image sequence pattern
+       */
+      std::string open_path_;
+      int sequence_start_ {-1};
       uint64_t calculated_length_ {0};
       types::AVFormatContextUPtr format_ctx_ {nullptr};
+      /**
+       * @brief Streams created once and shared by every audioStream()/visualStream() call. [AVStream index, stream]
+       */
+      std::map<int32_t, MediaStreamPtr> streams_;
+      std::mutex streams_mutex_;
       /**
        * @brief structure holding packets for a stream which was retrieved when retrieving packet for another stream
        * @note  By doing this, unnecessary seeks and av_read_frame are prevented
@@ -82,6 +118,11 @@ namespace media_handling::ffmpeg
       struct {
         mutable std::map<int32_t, int32_t> indexes_;
         std::map<int32_t, std::queue<types::AVPacketPtr>> queue_;
+        /**
+         * @brief Guards the format context and the queues so that streams can be read from different threads
+         */
+        mutable std::mutex mutex_;
+        FFMpegPacketPool pool_;
       } packeting_;
     private:
       /**
@@ -102,19 +143,47 @@ namespace media_handling::ffmpeg
        */
       types::AVPacketPtr nextPacket(const int stream_index);
       /**
-       * @brief Clear all data from the packet queue
+       * @brief Clear the queued packets of a stream, leaving those of other streams
+       * @note  The demuxer has to be locked by the caller
+       * @see   lockDemuxer
+       * @param stream_index  FFMpeg stream index
+       */
+      void resetPacketQueue(const int stream_index);
+      /**
+       * @brief Lock the demuxer for exclusive use i.e. whilst seeking
+       * @note  nextPacket, queueStream and unqueueStream lock it themselves
        */
-      void resetPacketQueue();
+      std::unique_lock<std::mutex> lockDemuxer() const;
       /**
        * @brief Retrieve the format context of the source
        * @return  context or null
        */
       AVFormatContext* context() const noexcept;
+      /**
+       * @brief Open a new demuxer of the source, independent of the one shared by its streams
+       * @return  context or null on failure
+       */
+      types::AVFormatContextUPtr openDemuxer() const;
+      /**
+       * @brief Retrieve an empty packet from the source's pool
+       */
+      types::AVPacketPtr allocatePacket();
     private:
+      AVStream* findStream(const AVMediaType type, const int index) const;
+      MediaStreamPtr createStream(AVStream& stream);
+      /**
+       * @brief Retrieve the stream from the registry, creating it if needed
+       */
+      MediaStreamPtr sharedStream(AVStream& stream);
+      MediaStreamMap sharedStreams(const AVMediaType type);
       void extractProperties(const AVFormatContext& ctx);
       void extractMetadata(const AVDictionary& metadata);
       void extractStreamProperties(AVStream** streams, const uint32_t stream_count);
       void findFrameRate();
+      /**
+       * @brief Find the start timecode of the first visual stream from its metadata alone
+       */
+      std::optional<TimeCode> streamTimeCode() const;
       media_handling::OperationalPattern findOperationalPattern(const AVDictionary& metadata);
       /**
        * @brief Reset the instance to before it was initialised (minus properties)
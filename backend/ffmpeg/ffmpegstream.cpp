@@ -26,7 +26,10 @@
 */
 
 #include "ffmpegstream.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstring>
 #include <sstream>
 #include <thread>
 #include <fmt/core.h>
@@ -37,6 +40,7 @@
 #include "timecode.h"
 
 extern "C" {
+#include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/channel_layout.h>
@@ -56,9 +60,156 @@ using media_handling::MediaFramePtr;
 namespace mh = media_handling;
 
 namespace  {
-  std::array<char, ERR_LEN> err;
+  thread_local std::array<char, ERR_LEN> err;
+  /**
+   * @brief Properties only known from a decoded frame
+   */
+  const std::set<mh::MediaProperty> LAZY_PROPERTIES {mh::MediaProperty::FIELD_ORDER, mh::MediaProperty::COLOUR_SPACE,
+        mh::MediaProperty::PIXEL_ASPECT_RATIO, mh::MediaProperty::DISPLAY_ASPECT_RATIO};
+  /**
+   * @brief Create the frame pool of an output format. Failing is not fatal as frames convert without one
+   */
+  template <typename... Args>
+  std::shared_ptr<media_handling::ffmpeg::FFMpegFramePool> makeFramePool(Args&&... args)
+  {
+    try {
+      return std::make_shared<media_handling::ffmpeg::FFMpegFramePool>(std::forward<Args>(args)...);
+    } catch (const std::runtime_error& ex) {
+      LWARNING(ex.what());
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Fewest pixels worth converting as a band of their own
+   */
+  constexpr int64_t MIN_BAND_PIXELS = 256 * 1024;
+
+  using Bands = std::vector<mh::ffmpeg::FFMpegMediaFrame::Band>;
+
+  /**
+   * @brief Split a pixel conversion into bands to convert in parallel, with the band count chosen from the frame size
+   * @note  Only conversions without any vertical filtering are split, as swscale clamps its filters at the edges
+   *        of each band's context rather than reading the neighbouring rows. Vertically subsampled chroma is
+   *        filtered unless the frame is point sampled at its own size
+   * @param contexts  false==bands only of rows, for a conversion that doesn't use swscale
+   * @return bands, or null if not worth splitting
+   */
+  std::shared_ptr<const Bands> makeBands(const mh::Dimensions& src, const AVPixelFormat src_fmt,
+                                         const mh::Dimensions& out, const AVPixelFormat out_fmt, const int flags,
+                                         const bool contexts)
+  {
+    if (src.height != out.height) {
+      return nullptr;
+    }
+    const auto src_desc = av_pix_fmt_desc_get(src_fmt);
+    const auto out_desc = av_pix_fmt_desc_get(out_fmt);
+    constexpr auto UNSPLITTABLE = AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL;
+    if ( (src_desc == nullptr) || (out_desc == nullptr) || (((src_desc->flags | out_desc->flags) & UNSPLITTABLE) != 0) ) {
+      return nullptr;
+    }
+    const auto point_sampled = (src.width == out.width) && ((flags & SWS_POINT) != 0);
+    if (contexts && !point_sampled && ((src_desc->log2_chroma_h != 0) || (out_desc->log2_chroma_h != 0))) {
+      return nullptr;
+    }
+    // Bands start on whole chroma rows
+    const int align = 1 << std::max(src_desc->log2_chroma_h, out_desc->log2_chroma_h);
+    const auto pixels = static_cast<int64_t>(std::max(src.width, out.width)) * out.height;
+    const auto workers = static_cast<int64_t>(mh::Executor::global()->workers());
+    const auto count = std::min({pixels / MIN_BAND_PIXELS, static_cast<int64_t>(out.height / align), workers});
+    if (count <= 1) {
+      return nullptr;
+    }
+    auto bands = std::make_shared<Bands>();
+    const auto rows = FFALIGN(static_cast<int>((out.height + count - 1) / count), align);
+    for (int y = 0; y < out.height; y += rows) {
+      const auto height = std::min(rows, out.height - y);
+      if (!contexts) {
+        bands->push_back({nullptr, y, height});
+        continue;
+      }
+      SwsContext* ctx = sws_getContext(src.width, height, src_fmt, out.width, height, out_fmt, flags,
+                                       nullptr, nullptr, nullptr);
+      if (ctx == nullptr) {
+        LWARNING("Failed to create a conversion band, converting whole frames");
+        return nullptr;
+      }
+      bands->push_back({mh::ffmpeg::types::SWSContextPtr(ctx, mh::ffmpeg::types::swsContextDeleter), y, height});
+    }
+    return bands;
+  }
+
+  /**
+   * @brief The largest reduction of decode dimensions the codec supports that is no smaller than the output
+   */
+  int lowResolutionLevel(const AVCodec& codec, const mh::Dimensions& src, const mh::Dimensions& out)
+  {
+    int level = 0;
+    while ( (level < codec.max_lowres)
+            && (AV_CEIL_RSHIFT(src.width, level + 1) >= out.width)
+            && (AV_CEIL_RSHIFT(src.height, level + 1) >= out.height) ) {
+      ++level;
+    }
+    return level;
+  }
+
+  /**
+   * @brief Decoders open in the process, for sharing the decode thread budget between them
+   */
+  struct
+  {
+    /**
+     * @brief Decoders without a THREADS property, which share the budget
+     */
+    std::atomic<int32_t> automatic_ {0};
+    /**
+     * @brief Threads of the decoders with a THREADS property, taken out of the budget
+     */
+    std::atomic<int32_t> explicit_threads_ {0};
+  } open_decoders;
+
+  void registerDecoder(const int32_t threads) noexcept
+  {
+    if (threads > 0) {
+      open_decoders.explicit_threads_ += threads;
+    } else {
+      ++open_decoders.automatic_;
+    }
+  }
+
+  void unregisterDecoder(const int32_t threads) noexcept
+  {
+    if (threads > 0) {
+      open_decoders.explicit_threads_ -= threads;
+    } else {
+      --open_decoders.automatic_;
+    }
+  }
+
+  /**
+   * @brief The share of the decode thread budget for a decoder without a THREADS property
+   */
+  int32_t automaticThreads() noexcept
+  {
+    const auto hardware = std::max(static_cast<int32_t>(std::thread::hardware_concurrency()), 1);
+    const auto budget = mh::global::decode_thread_budget.load();
+    if (budget <= 0) {
+      return hardware;
+    }
+    const auto available = std::max(budget - open_decoders.explicit_threads_.load(), 1);
+    return std::clamp(available / std::max(open_decoders.automatic_.load(), 1), 1, hardware);
+  }
+
   const std::set<AVCodecID> NOBITRATE_CODECS {AV_CODEC_ID_WAVPACK, AV_CODEC_ID_PCM_S16LE, AV_CODEC_ID_PCM_S32LE,
         AV_CODEC_ID_FLAC};
+
+  /**
+   * @brief Free callback of a buffer wrapping a written frame's data, which holds the frame until then
+   */
+  void releaseSample(void* opaque, uint8_t* /*data*/)
+  {
+    delete static_cast<MediaFramePtr*>(opaque);
+  }
 }
 
 
@@ -82,14 +233,17 @@ FFMpegStream::FFMpegStream(FFMpegSource* parent, AVStream* const stream)
     throw std::runtime_error(msg);
   }
 
-  codec_ctx_->thread_count = static_cast<int32_t>(std::thread::hardware_concurrency());
+  registerDecoder(decoder_threads_);
+  setupThreads(*codec_ctx_);
   setupDecoder(stream_->codecpar->codec_id, opts_);
+  av_dict_copy(&decoder_opts_, opts_, 0);
   // Open codec
   err_code = avcodec_open2(codec_ctx_, codec_, &opts_);
   if (err_code < 0) {
     av_strerror(err_code, err.data(), ERR_LEN);
     const auto msg = fmt::format("Could not open codec:  {}", err.data());
     LCRITICAL(msg);
+    unregisterDecoder(decoder_threads_);
     throw std::runtime_error(msg);
   }
 
@@ -102,6 +256,7 @@ FFMpegStream::FFMpegStream(FFMpegSource* parent, AVStream* const stream)
       type_ = StreamType::VIDEO;
     }
   } else {
+    unregisterDecoder(decoder_threads_);
     throw std::exception(); // TODO: custom type
   }
 
@@ -128,16 +283,52 @@ FFMpegStream::FFMpegStream(FFMpegSink* sink, const AVCodecID codec)
   }
 }
 
+FFMpegStream::FFMpegStream(FFMpegSink* sink, const AVCodecParameters& parameters, const AVRational time_base)
+  : sink_(sink),
+    copy_time_base_(time_base)
+{
+  if (sink_ == nullptr) {
+    throw std::runtime_error("Required parameter(s) is/are null");
+  }
+  if (parameters.codec_type == AVMEDIA_TYPE_AUDIO) {
+    type_ = StreamType::AUDIO;
+  } else if (parameters.codec_type == AVMEDIA_TYPE_VIDEO) {
+    type_ = StreamType::VIDEO;
+  } else {
+    throw std::runtime_error("Only video and audio streams can be copied");
+  }
+  stream_ = avformat_new_stream(&sink_->formatContext(), nullptr); // Freed by FormatContext
+  if (stream_ == nullptr) {
+    throw std::runtime_error("Failed to add a stream to the container");
+  }
+  const auto ret = avcodec_parameters_copy(stream_->codecpar, &parameters);
+  if (ret < 0) {
+    av_strerror(ret, err.data(), ERR_LEN);
+    throw std::runtime_error(fmt::format("Failed to copy codec parameters, msg={}", err.data()));
+  }
+  // The source container's tag may mean nothing, or something else, in this one
+  stream_->codecpar->codec_tag = 0;
+  stream_->time_base = time_base;
+  pkt_ = av_packet_alloc();
+}
+
 FFMpegStream::~FFMpegStream()
 {
-  if (parent_!= nullptr) {
+  // Queued encode tasks reference this stream
+  flush();
+  stopReadAhead(true);
+  if ( (parent_!= nullptr) && !demuxer_) {
     parent_->unqueueStream(source_index_);
   }
+  if (parent_ != nullptr) {
+    unregisterDecoder(decoder_threads_);
+  }
   stream_ = nullptr; //TODO: check this
   av_packet_free(&pkt_);
   avcodec_close(codec_ctx_);
   avcodec_free_context(&codec_ctx_);
   av_dict_free(&opts_);
+  av_dict_free(&decoder_opts_);
 }
 
 void FFMpegStream::setProperties(std::map<media_handling::MediaProperty, std::any> props)
@@ -151,6 +342,13 @@ void FFMpegStream::setProperties(std::map<media_handling::MediaProperty, std::an
 
 void FFMpegStream::setProperty(const MediaProperty prop, const std::any& value)
 {
+  if ( (parent_ != nullptr) && (codec_ctx_ != nullptr)
+       && ( (prop == MediaProperty::THREADS) || (prop == MediaProperty::THREAD_TYPE) ) ) {
+    // Decoder threading can be changed whilst in use, at the cost of reopening the decoder
+    media_handling::MediaPropertyObject::setProperty(prop, value);
+    setDecoderThreads();
+    return;
+  }
   if (setup_) {
     LWARNING("Setting/changing a property of a writing stream that is in use is prohibited");
   } else {
@@ -158,44 +356,82 @@ void FFMpegStream::setProperty(const MediaProperty prop, const std::any& value)
   }
 }
 
+bool FFMpegStream::hasProperty(const MediaProperty prop) const
+{
+  if (LAZY_PROPERTIES.count(prop) == 1) {
+    extractPendingFrameProperties();
+  }
+  return media_handling::MediaPropertyObject::hasProperty(prop);
+}
+
+
+std::any FFMpegStream::property(const MediaProperty prop, bool& is_valid) const
+{
+  if (LAZY_PROPERTIES.count(prop) == 1) {
+    extractPendingFrameProperties();
+  }
+  return media_handling::MediaPropertyObject::property(prop, is_valid);
+}
+
+
+std::map<media_handling::MediaProperty, std::any> FFMpegStream::properties() const
+{
+  extractPendingFrameProperties();
+  return media_handling::MediaPropertyObject::properties();
+}
+
+
 
 bool FFMpegStream::index()
 {
+  assert(parent_);
+  assert(stream_);
+  // Read with a demuxer of its own, as reading the shared one to the end would queue every other stream's packets
+  // and leave the source at its end
+  const auto demuxer = parent_->openDemuxer();
+  if (!demuxer) {
+    LWARNING("Failed to open a demuxer for indexing");
+    return false;
+  }
+  gsl::span<AVStream*> streams(demuxer->streams, demuxer->nb_streams);
+  for (auto& stream : streams) {
+    if (stream->index != stream_->index) {
+      stream->discard = AVDISCARD_ALL;
+    }
+  }
   // Intention is to change already set properties so unset lock
   setup_ = false;
-  MediaFramePtr fframe = this->frame(0);
-  if (fframe == nullptr) {
+  // Only the demuxer is needed for this. Decoding every frame is far too slow for long-GOP media
+  packet_index_.clear();
+  if (stream_->nb_frames > 0) {
+    packet_index_.reserve(static_cast<size_t>(stream_->nb_frames));
+  }
+  const auto pkt = parent_->allocatePacket();
+  assert(pkt);
+  while (av_read_frame(demuxer.get(), pkt.get()) >= 0) {
+    if (pkt->stream_index == stream_->index) {
+      packet_index_.append(*pkt);
+    }
+    av_packet_unref(pkt.get());
+  }
+
+  if (packet_index_.empty()) {
+    setup_ = true;
     return false;
   }
-  int64_t frame_count = 0;
-  int64_t frames_size = 0;
-  int64_t duration = 0;
+
   bool okay = true;
-  while ((fframe != nullptr) && okay) {
-    fframe->extractProperties();
-    frame_count++;
-    frames_size += fframe->property<int32_t>(MediaProperty::FRAME_PACKET_SIZE, okay);
-    duration += static_cast<int64_t>(fframe->property<Rational>(MediaProperty::DURATION, okay).toDouble() + 0.5);
-    fframe = this->frame();
+  const auto scale = this->property<Rational>(MediaProperty::TIMESCALE, okay);
+  if (!okay) {
+    setup_ = true;
+    return false;
   }
-
-  if (okay) {
-    this->setProperty(MediaProperty::FRAME_COUNT, frame_count);
-    const auto scale = this->property<Rational>(MediaProperty::TIMESCALE, okay);
-    if (!okay) {
-      setup_ = true;
-      return false;
-    }
-    const Rational dur = duration * scale;
-    this->setProperty(MediaProperty::DURATION, dur);
-    const auto rate = this->property<Rational>(MediaProperty::FRAME_RATE, okay);
-    if (!okay) {
-      setup_ = true;
-      return false;
-    }
-    const BitRate bit_rate = frames_size / (frame_count/rate);
+  this->setProperty(MediaProperty::FRAME_COUNT, static_cast<int64_t>(packet_index_.size()));
+  const Rational dur = packet_index_.duration() * scale;
+  this->setProperty(MediaProperty::DURATION, dur);
+  if (dur > 0) {
+    const BitRate bit_rate = (packet_index_.totalSize() * 8) / dur;
     this->setProperty(MediaProperty::BITRATE, bit_rate);
-
   }
   setup_ = true;
   return okay;
@@ -215,6 +451,41 @@ MediaFramePtr FFMpegStream::frameByTimestamp(const int64_t time_stamp)
 {
   assert(codec_ctx_);
 
+  if (keyframes_only_) {
+    return decodeKeyframe(time_stamp);
+  }
+
+  if ( (time_stamp == -1) && resume_timestamp_) {
+    // Continue on from the last frame retrieved rather than where the decoder happens to be
+    return frameByTimestamp(resume_timestamp_.value());
+  }
+  if (time_stamp >= 0) {
+    if (auto cached = frame_cache_.find(time_stamp)) {
+      resume_timestamp_ = types::frameTimestamp(*cached) + (cached->pkt_duration > 0 ? cached->pkt_duration : pts_intvl_);
+      return wrap(std::move(cached));
+    }
+  }
+  resume_timestamp_.reset();
+
+  if (read_ahead_.capacity_ > 0) {
+    if (auto result = takeReadAhead(time_stamp)) {
+      return result;
+    }
+    if (time_stamp == -1) {
+      // Nothing more could be read ahead
+      return nullptr;
+    }
+    stopReadAhead(true);
+    auto result = decodeByTimestamp(time_stamp);
+    startReadAhead();
+    return result;
+  }
+  return decodeByTimestamp(time_stamp);
+}
+
+
+MediaFramePtr FFMpegStream::decodeByTimestamp(const int64_t time_stamp)
+{
   if ((time_stamp >= 0) && (last_timestamp_ != time_stamp)) {
     const int diff = abs(last_timestamp_ - time_stamp);
     if ( (diff > pts_intvl_) || (time_stamp < last_timestamp_)) {
@@ -228,30 +499,49 @@ MediaFramePtr FFMpegStream::frameByTimestamp(const int64_t time_stamp)
 
   if (time_stamp == -1) {
     // Get next frame
-    return frame(*codec_ctx_, stream_->index);
+    auto decoded = decode(*codec_ctx_, stream_->index);
+    if (decoded) {
+      frame_cache_.insert(*decoded);
+    }
+    return wrap(std::move(decoded));
   }
 
-  MediaFramePtr result;
-  auto cnt = 0;
-  int64_t diff = INT_MAX;
-  bool okay;
-  do {
-    if (result = frame(*codec_ctx_, stream_->index); result) {
-      const auto start = result->timestamp();
-      diff = result->timestamp() - time_stamp;
-      const auto duration = result->property<Rational>(MediaProperty::DURATION, okay);
-      assert(okay);
-      const auto end = static_cast<int64_t>((start + duration).toDouble() + 0.5);
-      if ((time_stamp >= start) && (time_stamp < end)) {
-        // FIXME: this is not working where streams do not start pts=0
-        break;
-      }
+  // With an index the number of frames between the keyframe and the target is known
+  int64_t limit = RETRY_LIMIT;
+  if (const auto key = packet_index_.keyframeBefore(time_stamp)) {
+    limit = static_cast<int64_t>(packet_index_.packetsUntil(key.value(), time_stamp)) + codec_ctx_->has_b_frames + 1;
+  }
+
+  int64_t cnt = 0;
+  while (cnt++ < limit) {
+    auto decoded = decode(*codec_ctx_, stream_->index);
+    if (!decoded) {
+      break;
+    }
+    frame_cache_.insert(*decoded);
+    const auto start = types::frameTimestamp(*decoded);
+    const auto duration = decoded->pkt_duration > 0 ? decoded->pkt_duration : pts_intvl_;
+    // A frame without any timestamp cannot be placed, so it is taken as the next one
+    if ( (start == AV_NOPTS_VALUE) || (time_stamp < start + duration) ) {
+      // Only the requested frame is wrapped for output conversion. Those preceding it are discarded as decoded
+      return wrap(std::move(decoded));
     }
-  } while (result && (diff > pts_intvl_) && (cnt++ < RETRY_LIMIT));
-  if (!result && cnt >= RETRY_LIMIT) {
-    LWARNING(fmt::format("Failed to retrieve frame. ts={}", time_stamp));
   }
-  return result;
+  LWARNING(fmt::format("Failed to retrieve frame. ts={}", time_stamp));
+  return nullptr;
+}
+
+MediaFramePtr FFMpegStream::decodeKeyframe(const int64_t time_stamp)
+{
+  if (time_stamp >= 0) {
+    const auto target = nearestKeyframe(time_stamp).value_or(time_stamp);
+    if (!seek(target)) {
+      LWARNING(fmt::format("Failed to seek:  {}", target));
+      return nullptr;
+    }
+  }
+  // Everything but keyframes is discarded by the decoder so the next frame output is one
+  return wrap(decode(*codec_ctx_, stream_->index));
 }
 
 MediaFramePtr FFMpegStream::frameBySecond(const double second)
@@ -276,11 +566,47 @@ MediaFramePtr FFMpegStream::frameByFrameNumber(const int64_t frame_number)
   return this->frameByTimestamp(ts);
 }
 
+size_t FFMpegStream::frames(const int64_t start, const int64_t end, FrameBatch& batch)
+{
+  batch.clear();
+  if ( (start < 0) || (end <= start) ) {
+    LWARNING(fmt::format("Invalid frame range, start={} end={}", start, end));
+    return 0;
+  }
+  // The first frame may need a seek
+  auto first = frameByTimestamp(start);
+  if (!first) {
+    return 0;
+  }
+  auto next = frameEnd(*first, start);
+  batch.slot() = std::move(first);
+  batch.commit();
+  while (next < end) {
+    if (!readNext(batch)) {
+      break;
+    }
+    next = frameEnd(*batch[batch.size() - 1], next);
+  }
+  return batch.size();
+}
+
+
+size_t FFMpegStream::readBatch(const size_t count, FrameBatch& batch)
+{
+  batch.clear();
+  while ( (batch.size() < count) && readNext(batch) ) {
+  }
+  return batch.size();
+}
+
+
 bool FFMpegStream::writeFrame(MediaFramePtr sample)
 {
-  bool okay = true;
-  std::call_once(setup_encoder_, [&] { okay = setupEncoder(); });
-  if (!okay) {
+  if (copy_time_base_) {
+    LWARNING("Frames cannot be written to a stream that copies packets");
+    return false;
+  }
+  if (!sink_->setupEncoders()) {
     LCRITICAL("Failed to setup encoder");
     return false;
   }
@@ -288,14 +614,72 @@ bool FFMpegStream::writeFrame(MediaFramePtr sample)
     LCRITICAL("Stream has not been configured correctly for writing");
     return false;
   }
+  if (encode_.capacity_ == 0) {
+    return encode(sample);
+  }
+
+  std::unique_lock lock(encode_.mutex_);
+  // A producer faster than the encoder waits here instead of queuing without bound
+  encode_.cond_.wait(lock, [this] { return encode_.failed_ || (encode_.queue_.size() < encode_.capacity_); });
+  if (encode_.failed_) {
+    return false;
+  }
+  encode_.queue_.push_back(std::move(sample));
+  if (!encode_.running_) {
+    encode_.running_ = true;
+    Executor::global()->submit([this] { encodeQueued(); });
+  }
+  return true;
+}
+
+
+bool FFMpegStream::flush()
+{
+  std::unique_lock lock(encode_.mutex_);
+  encode_.cond_.wait(lock, [this] { return encode_.queue_.empty() && !encode_.running_; });
+  return !encode_.failed_;
+}
+
+
+void FFMpegStream::encodeQueued()
+{
+  while (true) {
+    MediaFramePtr sample;
+    {
+      std::lock_guard lock(encode_.mutex_);
+      if (encode_.queue_.empty()) {
+        encode_.running_ = false;
+        encode_.cond_.notify_all();
+        return;
+      }
+      sample = std::move(encode_.queue_.front());
+      encode_.queue_.pop_front();
+      encode_.cond_.notify_all();
+    }
+    if (!encode(sample)) {
+      std::lock_guard lock(encode_.mutex_);
+      encode_.failed_ = true;
+      encode_.queue_.clear();
+    }
+  }
+}
+
 
+bool FFMpegStream::encode(const MediaFramePtr& sample)
+{
   // send frame to encoder
   if (sample) {
     const auto data = sample->data();
     assert(data.data_);
+    types::AVFrameUPtr converted;
     if (input_format_.swr_context_ != nullptr) {
       // Convert audio
       assert(data.line_size_ > 0);
+      // The encoder may still reference the previous samples, in which case they are left to it
+      if (av_frame_make_writable(sink_frame_.get()) < 0) {
+        LCRITICAL("Failed to make the audio frame writable");
+        return false;
+      }
       const auto ret = swr_convert(input_format_.swr_context_.get(),
                                    sink_frame_->data, sink_frame_->linesize[0],
                                    const_cast<const uint8_t**>(data.data_), data.line_size_);
@@ -305,12 +689,16 @@ bool FFMpegStream::writeFrame(MediaFramePtr sample)
         LCRITICAL(msg);
         return false;
       }
-    } else if (input_format_.sws_context_ != nullptr) {
-      // TODO: convert video
+    } else if ( (input_format_.sws_context_ != nullptr)
+                && (data.pix_fmt_ != types::convertPixelFormat(sink_codec_ctx_->pix_fmt)) ) {
+      converted = convertInput(*sample, data);
+      if (converted == nullptr) {
+        return false;
+      }
     } else {
-      // Copy
-      for (auto ix = 0; ix < AV_NUM_DATA_POINTERS; ++ix) {
-        sink_frame_->data[ix] = data.data_[ix];
+      converted = referenceInput(sample, data);
+      if (converted == nullptr) {
+        return false;
       }
     }
 
@@ -320,7 +708,11 @@ bool FFMpegStream::writeFrame(MediaFramePtr sample)
     } else {
       sink_frame_->pts++;
     }
-    auto ret = avcodec_send_frame(sink_codec_ctx_.get(), sink_frame_.get());
+    if (converted) {
+      converted->pts = sink_frame_->pts;
+    }
+    // The encoder references a converted frame's pooled buffer, or the written frame, until it has finished with it
+    auto ret = avcodec_send_frame(sink_codec_ctx_.get(), converted ? converted.get() : sink_frame_.get());
     if (ret < 0) {
       av_strerror(ret, err.data(), ERR_LEN);
       const auto msg = fmt::format("Failed to send frame to encoder: {}", err.data());
@@ -353,14 +745,10 @@ bool FFMpegStream::writeFrame(MediaFramePtr sample)
     }
 
     pkt_->stream_index = stream_->index;
-    av_packet_rescale_ts(pkt_, sink_codec_ctx_->time_base, stream_->time_base);
     // Send packet to container writer
-    ret = av_interleaved_write_frame(&sink_->formatContext(), pkt_);
+    const auto written = sink_->writePacket(*pkt_, sink_codec_ctx_->time_base);
     av_packet_unref(pkt_);
-    if (ret < 0 ){
-      av_strerror(ret, err.data(), ERR_LEN);
-      const auto msg = fmt::format("Failed to write frame to container, msg={}", err.data());
-      LCRITICAL(msg);
+    if (!written) {
       return false;
     }
   } //while
@@ -377,6 +765,47 @@ int32_t FFMpegStream::sourceIndex() const noexcept
   return source_index_;
 }
 
+
+AVStream* FFMpegStream::avStream() const noexcept
+{
+  return stream_;
+}
+
+
+media_handling::ffmpeg::types::AVPacketPtr FFMpegStream::readPacket()
+{
+  if (parent_ == nullptr) {
+    LWARNING("Packets can only be read from a source stream");
+    return nullptr;
+  }
+  return nextPacket(source_index_);
+}
+
+
+bool FFMpegStream::copyPacket(const AVPacket& packet)
+{
+  if ( (sink_ == nullptr) || !copy_time_base_) {
+    LWARNING("Stream was not set up to copy packets");
+    return false;
+  }
+  // The sink takes the reference it is given, so the caller keeps its packet
+  auto ref = av_packet_clone(&packet);
+  if (ref == nullptr) {
+    LCRITICAL("Failed to reference the copied packet");
+    return false;
+  }
+  ref->stream_index = stream_->index;
+  ref->pos = -1;
+  if (!sink_->setupEncoders()) {
+    LCRITICAL("Failed to setup the sink's encoders");
+    av_packet_free(&ref);
+    return false;
+  }
+  const auto written = sink_->writePacket(*ref, *copy_time_base_);
+  av_packet_free(&ref);
+  return written;
+}
+
 bool FFMpegStream::setOutputFormat(const PixelFormat format,
                                    const media_handling::Dimensions& dims,
                                    media_handling::InterpolationMethod interp)
@@ -386,6 +815,8 @@ bool FFMpegStream::setOutputFormat(const PixelFormat format,
     LWARNING("Stream is setup for encoding");
     return false;
   }
+  // The read-ahead thread converts with output_format_
+  stopReadAhead(false);
   const AVPixelFormat output_av_fmt = types::convertPixelFormat(format);
   if (output_av_fmt == AV_PIX_FMT_NONE) {
     LCRITICAL("FFMpegStream::setOutputFormat() -- Unknown AV pixel format");
@@ -419,14 +850,30 @@ bool FFMpegStream::setOutputFormat(const PixelFormat format,
     return std::make_tuple(dims, media_handling::ffmpeg::types::convertInterpolationMethod(interp));
   }();
 
+  // Decoding at a reduced resolution saves both the decode and the downscale work
+  const auto lowres = low_resolution_decode_ ? lowResolutionLevel(*codec_, src_dims, out_dims) : 0;
+  if ( (lowres != codec_ctx_->lowres) && !reopenDecoder(lowres) ) {
+    LWARNING(fmt::format("Failed to change the decode resolution to level {}", lowres));
+  }
+  src_dims = {AV_CEIL_RSHIFT(src_dims.width, codec_ctx_->lowres), AV_CEIL_RSHIFT(src_dims.height, codec_ctx_->lowres)};
+
   SwsContext* ctx = sws_getContext(src_dims.width, src_dims.height, src_av_fmt,
                                    out_dims.width, out_dims.height, output_av_fmt,
                                    out_interp,
                                    nullptr, nullptr, nullptr);
   assert(ctx);
   output_format_.sws_context_ = std::shared_ptr<SwsContext>(ctx, types::swsContextDeleter);
+  output_format_.mutex_ = std::make_shared<std::mutex>();
   output_format_.pix_fmt_ = format;
   output_format_.dims_ = out_dims;
+  output_format_.frame_pool_ = makeFramePool(output_av_fmt, out_dims);
+  // Unscaled conversions between the commonest formats have vectorised converters of their own
+  output_format_.fast_conversion_.reset();
+  if ( (src_dims.width == out_dims.width) && (src_dims.height == out_dims.height) ) {
+    output_format_.fast_conversion_ = FFMpegPixelConversion::find(src_av_fmt, output_av_fmt);
+  }
+  output_format_.bands_ = makeBands(src_dims, src_av_fmt, out_dims, output_av_fmt, out_interp,
+                                    !output_format_.fast_conversion_);
 
   return output_format_.sws_context_ != nullptr;
 }
@@ -437,6 +884,8 @@ bool FFMpegStream::setOutputFormat(const SampleFormat format, std::optional<Samp
     LWARNING("Stream is setup for encoding");
     return false;
   }
+  // The read-ahead thread converts with output_format_
+  stopReadAhead(false);
   bool okay = false;
   const auto layout = property<ChannelLayout>(MediaProperty::AUDIO_LAYOUT, okay);
   assert(okay);
@@ -469,6 +918,140 @@ bool FFMpegStream::setOutputFormat(const SampleFormat format, std::optional<Samp
   output_format_.layout_ = layout;
   output_format_.sample_rate_ = rate.has_value() ? rate.value() : sample_rate;
   output_format_.swr_context_ = std::shared_ptr<SwrContext>(ctx, types::swrContextDeleter);
+  output_format_.mutex_ = std::make_shared<std::mutex>();
+  output_format_.frame_pool_ = makeFramePool(av_format, av_layout, output_format_.sample_rate_,
+                                             AUDIO_CONVERSION_SAMPLES);
+  return true;
+}
+
+
+media_handling::ffmpeg::types::AVFrameUPtr FFMpegStream::convertInput(IMediaFrame& sample, const IMediaFrame::FrameData& data)
+{
+  const auto& dims = input_format_.dims_;
+  if ( (data.dims_.width != dims.width) || (data.dims_.height != dims.height) ) {
+    LWARNING(fmt::format("Frame dimensions {}x{} differ from the stream's {}x{}", data.dims_.width, data.dims_.height,
+                         dims.width, dims.height));
+    return nullptr;
+  }
+  types::AVFrameUPtr dst = input_format_.frame_pool_ ? input_format_.frame_pool_->acquire() : nullptr;
+  if (dst == nullptr) {
+    dst.reset(av_frame_alloc());
+    dst->format = sink_codec_ctx_->pix_fmt;
+    dst->width = dims.width;
+    dst->height = dims.height;
+    const auto ret = av_frame_get_buffer(dst.get(), 0);
+    if (ret < 0) {
+      av_strerror(ret, err.data(), ERR_LEN);
+      LCRITICAL(fmt::format("Failed to allocate frame for converted input, msg={}", err.data()));
+      return nullptr;
+    }
+  }
+
+  types::AVFrameUPtr view(av_frame_alloc());
+  const auto src_fmt = types::convertPixelFormat(input_format_.pix_fmt_);
+  const auto ff_frame = dynamic_cast<FFMpegMediaFrame*>(&sample);
+  const AVFrame* src = ff_frame != nullptr ? ff_frame->dataFrame() : nullptr;
+  if ( (src == nullptr) || (src->format != src_fmt) ) {
+    if (!describeInput(data, src_fmt, *view)) {
+      return nullptr;
+    }
+    src = view.get();
+  }
+
+  if ( !(input_format_.bands_ && FFMpegMediaFrame::scaleBands(*input_format_.bands_, *src, *dst)) ) {
+    const auto ret = sws_scale(input_format_.sws_context_.get(), src->data, src->linesize, 0, src->height, dst->data,
+                               dst->linesize);
+    if (ret <= 0) {
+      LCRITICAL("Failed to convert the input frame");
+      return nullptr;
+    }
+  }
+  return dst;
+}
+
+
+media_handling::ffmpeg::types::AVFrameUPtr FFMpegStream::referenceInput(const MediaFramePtr& sample,
+                                                                         const IMediaFrame::FrameData& data)
+{
+  types::AVFrameUPtr frame(av_frame_alloc());
+  const auto ff_frame = std::dynamic_pointer_cast<FFMpegMediaFrame>(sample);
+  const AVFrame* src = ff_frame != nullptr ? ff_frame->dataFrame() : nullptr;
+  if ( (src != nullptr) && (src->buf[0] != nullptr) && (src->format == sink_frame_->format)
+       && (src->width == sink_frame_->width) && (src->height == sink_frame_->height) ) {
+    // Share the decoded frame's buffers
+    const auto ret = av_frame_ref(frame.get(), src);
+    if (ret < 0) {
+      av_strerror(ret, err.data(), ERR_LEN);
+      LCRITICAL(fmt::format("Failed to reference the written frame, msg={}", err.data()));
+      return nullptr;
+    }
+    // Otherwise the encoder would repeat the source's frame types
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    return frame;
+  }
+
+  int size = 0;
+  if (sink_codec_ctx_->codec_type == AVMEDIA_TYPE_AUDIO) {
+    frame->format = sink_frame_->format;
+    frame->sample_rate = sink_frame_->sample_rate;
+    frame->channel_layout = sink_frame_->channel_layout;
+    frame->channels = sink_frame_->channels;
+    frame->nb_samples = data.sample_count_ >= 0 ? data.sample_count_ : sink_frame_->nb_samples;
+    const auto planes = av_sample_fmt_is_planar(static_cast<AVSampleFormat>(frame->format)) ? frame->channels : 1;
+    if ( (planes > AV_NUM_DATA_POINTERS)
+         || (av_samples_get_buffer_size(&size, frame->channels, frame->nb_samples,
+                                        static_cast<AVSampleFormat>(frame->format), 1) < 0) ) {
+      LCRITICAL("Failed to determine the line size of the written samples");
+      return nullptr;
+    }
+    frame->linesize[0] = size;
+    for (auto ix = 0; ix < planes; ++ix) {
+      frame->data[ix] = data.data_[ix];
+    }
+    frame->extended_data = frame->data;
+  } else {
+    const Dimensions dims {sink_frame_->width, sink_frame_->height};
+    if ( (data.dims_.width != dims.width) || (data.dims_.height != dims.height) ) {
+      LWARNING(fmt::format("Frame dimensions {}x{} differ from the stream's {}x{}", data.dims_.width,
+                           data.dims_.height, dims.width, dims.height));
+      return nullptr;
+    }
+    if (!describeInput(data, static_cast<AVPixelFormat>(sink_frame_->format), *frame)) {
+      return nullptr;
+    }
+    size = frame->linesize[0] * frame->height;
+  }
+
+  // The buffer spans plane 0 only but owns a reference to the whole frame, which lives until the encoder releases it
+  auto owner = std::make_unique<MediaFramePtr>(sample);
+  frame->buf[0] = av_buffer_create(frame->data[0], size, &releaseSample, owner.get(), AV_BUFFER_FLAG_READONLY);
+  if (frame->buf[0] == nullptr) {
+    LCRITICAL("Failed to wrap the written frame's data");
+    return nullptr;
+  }
+  owner.release();
+  return frame;
+}
+
+
+bool FFMpegStream::describeInput(const IMediaFrame::FrameData& data, const AVPixelFormat format, AVFrame& frame) const
+{
+  // Only plane 0's stride is known, so the others are taken to be in proportion to it
+  frame.format = format;
+  frame.width = data.dims_.width;
+  frame.height = data.dims_.height;
+  const auto ret = av_image_fill_linesizes(frame.linesize, format, frame.width);
+  if ( (ret < 0) || (frame.linesize[0] <= 0) ) {
+    LCRITICAL("Failed to determine the line sizes of the input frame");
+    return false;
+  }
+  const auto packed = frame.linesize[0];
+  const auto stride = data.line_size_ > 0 ? data.line_size_ : packed;
+  for (auto ix = 0; (ix < 4) && (frame.linesize[ix] > 0); ++ix) {
+    frame.linesize[ix] = static_cast<int>((static_cast<int64_t>(frame.linesize[ix]) * stride) / packed);
+    frame.data[ix] = data.data_[ix];
+  }
+  frame.extended_data = frame.data;
   return true;
 }
 
@@ -493,18 +1076,29 @@ bool FFMpegStream::setInputFormat(const PixelFormat format)
     }
   } while ((!okay) && (fmt != AV_PIX_FMT_NONE));
 
+  // Frames of a supported format go to the encoder as they are
+  input_format_.sws_context_.reset();
+  input_format_.frame_pool_.reset();
+  input_format_.bands_.reset();
+  input_format_.pix_fmt_ = format;
+
   if (!okay) {
     const auto dims = this->property<Dimensions>(MediaProperty::DIMENSIONS, okay);
     if (okay) {
+      const auto encoder_fmt = codec_->pix_fmts[0];
       SwsContext* ctx = sws_getContext(dims.width, dims.height, ff_format,
-                                       dims.width, dims.height, codec_->pix_fmts[0],
+                                       dims.width, dims.height, encoder_fmt,
                                        0,
                                        nullptr, nullptr, nullptr);
-      assert(ctx);
-      output_format_.sws_context_ = std::shared_ptr<SwsContext>(ctx, types::swsContextDeleter);
-      output_format_.pix_fmt_ = format;
-      output_format_.dims_ = dims;
-      sink_codec_ctx_->pix_fmt = codec_->pix_fmts[0];
+      if (ctx == nullptr) {
+        LCRITICAL("Failed to create the input format converter");
+        return false;
+      }
+      input_format_.sws_context_ = std::shared_ptr<SwsContext>(ctx, types::swsContextDeleter);
+      input_format_.dims_ = dims;
+      input_format_.frame_pool_ = makeFramePool(encoder_fmt, dims);
+      input_format_.bands_ = makeBands(dims, ff_format, dims, encoder_fmt, 0, true);
+      sink_codec_ctx_->pix_fmt = encoder_fmt;
       LWARNING(fmt::format("Auto converting input format to {}", codec_->pix_fmts[0]));
       return true;
     }
@@ -576,6 +1170,139 @@ void FFMpegStream::initialise() noexcept
   setup_ = true;
 }
 
+const media_handling::ffmpeg::FFMpegPacketIndex& FFMpegStream::packetIndex() const noexcept
+{
+  return packet_index_;
+}
+
+bool FFMpegStream::useIndependentDemuxer()
+{
+  assert(parent_);
+  if (demuxer_) {
+    return true;
+  }
+  auto demuxer = parent_->openDemuxer();
+  if (!demuxer) {
+    LWARNING("Failed to open an independent demuxer");
+    return false;
+  }
+  gsl::span<AVStream*> streams(demuxer->streams, demuxer->nb_streams);
+  for (auto& stream : streams) {
+    if (stream->index != stream_->index) {
+      // Spare the demuxer from any work for the other streams
+      stream->discard = AVDISCARD_ALL;
+    }
+  }
+  stopReadAhead(true);
+  {
+    const auto lock = parent_->lockDemuxer();
+    parent_->resetPacketQueue(source_index_);
+  }
+  parent_->unqueueStream(source_index_);
+  demuxer_ = std::move(demuxer);
+  // The new demuxer is at the start of the stream
+  avcodec_flush_buffers(codec_ctx_);
+  last_timestamp_ = -1;
+  resume_timestamp_.reset();
+  return true;
+}
+
+void FFMpegStream::setLowResolutionDecode(const bool enabled)
+{
+  low_resolution_decode_ = enabled;
+}
+
+
+int FFMpegStream::lowResolution() const noexcept
+{
+  return codec_ctx_ != nullptr ? codec_ctx_->lowres : 0;
+}
+
+
+void FFMpegStream::setKeyframesOnly(const bool enabled)
+{
+  if (codec_ctx_ == nullptr) {
+    LWARNING("Stream has no decoder");
+    return;
+  }
+  // Frames read ahead were decoded with the previous setting
+  stopReadAhead(true);
+  resume_timestamp_.reset();
+  keyframes_only_ = enabled;
+  codec_ctx_->skip_frame = enabled ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+}
+
+
+bool FFMpegStream::keyframesOnly() const noexcept
+{
+  return keyframes_only_;
+}
+
+
+std::optional<int64_t> FFMpegStream::nearestKeyframe(const int64_t time_stamp) const
+{
+  const auto before = packet_index_.keyframeBefore(time_stamp);
+  const auto after = packet_index_.keyframeAfter(time_stamp);
+  if (!before && !after) {
+    return {};
+  }
+  if (!after) {
+    return packet_index_.timestamp(before.value());
+  }
+  if (!before) {
+    return packet_index_.timestamp(after.value());
+  }
+  const auto before_ts = packet_index_.timestamp(before.value());
+  const auto after_ts = packet_index_.timestamp(after.value());
+  return (time_stamp - before_ts) <= (after_ts - time_stamp) ? before_ts : after_ts;
+}
+
+
+void FFMpegStream::setReadAhead(const size_t frames, const bool convert)
+{
+  // Frames already read ahead are kept as the decoder has moved past them
+  stopReadAhead(false);
+  read_ahead_.capacity_ = frames;
+  read_ahead_.convert_ = convert;
+}
+
+void FFMpegStream::setFrameCacheBudget(const size_t bytes)
+{
+  frame_cache_.setBudget(bytes);
+  resume_timestamp_.reset();
+}
+
+const media_handling::ffmpeg::FFMpegFrameCache& FFMpegStream::frameCache() const noexcept
+{
+  return frame_cache_;
+}
+
+bool FFMpegStream::setBufferAllocator(BufferAllocatorPtr allocator)
+{
+  if ( (parent_ == nullptr) || (codec_ctx_ == nullptr) ) {
+    LWARNING("Buffer allocators are only used for decoding");
+    return false;
+  }
+  if ( (type_ != StreamType::VIDEO) && (type_ != StreamType::IMAGE) ) {
+    LWARNING("Buffer allocators are only used for visual streams");
+    return false;
+  }
+  if (allocator == buffer_allocator_) {
+    return true;
+  }
+  // The read-ahead task converts with output_format_ and decodes into buffer_allocator_
+  stopReadAhead(true);
+  buffer_allocator_ = allocator;
+  output_format_.allocator_ = allocator;
+  // The callback cannot be swapped on an open decoder, whose frame threads may be allocating. Frames already decoded
+  // keep their own buffers
+  if (!reopenDecoder(codec_ctx_->lowres)) {
+    LWARNING("Failed to reopen the decoder with the allocator");
+    return false;
+  }
+  return true;
+}
+
 
 void FFMpegStream::extractProperties(const AVStream& stream, const AVCodecContext& context)
 {
@@ -669,7 +1396,11 @@ void FFMpegStream::extractVisualProperties(const AVStream& stream, const AVCodec
   const Profile prof = types::convertProfile(context.profile);
   this->setProperty(MediaProperty::PROFILE, prof);
 
-  extractFrameProperties();
+  if (media_handling::global::lazy_stream_properties) {
+    frame_properties_pending_ = true;
+  } else {
+    extractFrameProperties();
+  }
 }
 
 void FFMpegStream::extractAudioProperties(const AVStream& stream, const AVCodecContext& context)
@@ -692,10 +1423,38 @@ bool FFMpegStream::seek(const int64_t time_stamp)
   assert(parent_);
   assert(stream_);
   assert(codec_ctx_);
-  parent_->resetPacketQueue();
-  avcodec_flush_buffers(codec_ctx_);
-  const int ret = av_seek_frame(parent_->context(), stream_->index, time_stamp, SEEK_DIRECTION);
-  LDEBUG(fmt::format("Seeking. ts={}, idx={}", time_stamp, stream_->index));
+  // The decoder is this stream's alone, so it is reopened or flushed before taking the demuxer that other streams wait
+  // on
+  if ( (decoder_threads_ == 0) && (requested_threads_ != automaticThreads()) && openDecoder(codec_ctx_->lowres) ) {
+    // A new decoder is as good as a flushed one, so take this chance to adopt the current share of the thread budget
+    LDEBUG(fmt::format("Decoder threads changed to {}", requested_threads_));
+  } else {
+    avcodec_flush_buffers(codec_ctx_);
+  }
+  // An independent demuxer is only used by this stream
+  std::unique_lock<std::mutex> lock;
+  if (!demuxer_) {
+    lock = parent_->lockDemuxer();
+    parent_->resetPacketQueue(stream_->index);
+  }
+  // When indexed, land exactly on the preceding keyframe instead of relying on the container's guess
+  auto target = time_stamp;
+  int ret = -1;
+  if (const auto key = packet_index_.keyframeBefore(time_stamp)) {
+    target = packet_index_.timestamp(key.value());
+    if (const auto pos = packet_index_.position(key.value()); (pos >= 0) && seekableByBytes()) {
+      ret = av_seek_frame(demuxContext(), stream_->index, pos, AVSEEK_FLAG_BYTE);
+      LDEBUG(fmt::format("Seeking by bytes. ts={}, pos={}, idx={}", time_stamp, pos, stream_->index));
+    } else {
+      // min == max so the demuxer cannot settle on any other keyframe
+      ret = avformat_seek_file(demuxContext(), stream_->index, target, target, target, 0);
+      LDEBUG(fmt::format("Seeking to keyframe. ts={}, target={}, idx={}", time_stamp, target, stream_->index));
+    }
+  }
+  if (ret < 0) {
+    ret = av_seek_frame(demuxContext(), stream_->index, target, SEEK_DIRECTION);
+    LDEBUG(fmt::format("Seeking. ts={}, target={}, idx={}", time_stamp, target, stream_->index));
+  }
   if (ret < 0) {
     av_strerror(ret, err.data(), ERR_LEN);
     LWARNING(fmt::format("Could not seek frame: {}", err.data()));
@@ -704,22 +1463,144 @@ bool FFMpegStream::seek(const int64_t time_stamp)
   return true;
 }
 
+bool FFMpegStream::seekableByBytes() const
+{
+  assert(parent_);
+  const auto fmt = demuxContext()->iformat;
+  assert(fmt);
+  // Same heuristic as ffplay: timestamps are unreliable for seeking where they can be discontinuous
+  return ( (fmt->flags & AVFMT_TS_DISCONT) != 0)
+      && ( (fmt->flags & AVFMT_NO_BYTE_SEEK) == 0)
+      && (strcmp(fmt->name, "ogg") != 0);
+}
+
+
+bool FFMpegStream::openDecoder(const int lowres)
+{
+  assert(codec_);
+  assert(codec_ctx_);
+  AVCodecContext* ctx = avcodec_alloc_context3(codec_);
+  assert(ctx);
+  int err_code = avcodec_parameters_to_context(ctx, stream_->codecpar);
+  if (err_code >= 0) {
+    setupThreads(*ctx);
+    ctx->skip_frame = codec_ctx_->skip_frame;
+    ctx->opaque = this;
+    ctx->get_buffer2 = buffer_allocator_ ? &FFMpegStream::getBuffer : &avcodec_default_get_buffer2;
+    ctx->lowres = lowres;
+    AVDictionary* opts = nullptr;
+    av_dict_copy(&opts, decoder_opts_, 0);
+    err_code = avcodec_open2(ctx, codec_, &opts);
+    av_dict_free(&opts);
+  }
+  if (err_code < 0) {
+    av_strerror(err_code, err.data(), ERR_LEN);
+    LWARNING(fmt::format("Could not reopen codec: {}", err.data()));
+    avcodec_free_context(&ctx);
+    return false;
+  }
+  avcodec_free_context(&codec_ctx_);
+  codec_ctx_ = ctx;
+  return true;
+}
+
 
-void FFMpegStream::setupDecoder(const AVCodecID codec_id, AVDictionary* dict) const
+bool FFMpegStream::reopenDecoder(const int lowres)
+{
+  // Frames decoded so far may be at a different resolution
+  stopReadAhead(true);
+  frame_cache_.clear();
+  if (!openDecoder(lowres)) {
+    return false;
+  }
+  // The new decoder has no references so restart from a keyframe
+  if (!seek(0)) {
+    LWARNING("Failed to return to the start of the stream");
+  }
+  last_timestamp_ = -1;
+  resume_timestamp_.reset();
+  return true;
+}
+
+
+void FFMpegStream::setupThreads(AVCodecContext& ctx)
+{
+  requested_threads_ = decoder_threads_ > 0 ? decoder_threads_ : automaticThreads();
+  ctx.thread_count = requested_threads_;
+  switch (thread_type_) {
+    case ThreadType::FRAME:
+      ctx.thread_type = FF_THREAD_FRAME;
+      break;
+    case ThreadType::SLICE:
+      ctx.thread_type = FF_THREAD_SLICE;
+      break;
+    case ThreadType::AUTO:
+      [[fallthrough]];
+    default:
+      ctx.thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+      break;
+  }
+}
+
+
+void FFMpegStream::setDecoderThreads()
+{
+  bool is_valid;
+  const auto threads = std::max(this->property<int32_t>(MediaProperty::THREADS, is_valid), 0);
+  auto type = this->property<ThreadType>(MediaProperty::THREAD_TYPE, is_valid);
+  if (!is_valid) {
+    type = ThreadType::AUTO;
+  }
+  if ( (threads == decoder_threads_) && (type == thread_type_) ) {
+    return;
+  }
+  unregisterDecoder(decoder_threads_);
+  registerDecoder(threads);
+  decoder_threads_ = threads;
+  thread_type_ = type;
+  // Threading is fixed once a decoder is open
+  if (!reopenDecoder(codec_ctx_->lowres)) {
+    LWARNING("Failed to change the decoder threading");
+  }
+}
+
+
+int32_t FFMpegStream::decoderThreads() const noexcept
+{
+  return requested_threads_;
+}
+
+
+void FFMpegStream::setupDecoder(const AVCodecID codec_id, AVDictionary*& dict) const
 {
   if (codec_id == AV_CODEC_ID_H264) {
-    // NOTE: av_dict_set leaks memory, nothing we can do
     av_dict_set(&dict, "tune", "fastdecode", 0);
     av_dict_set(&dict, "tune", "zerolatency", 0);
   }
 }
 
 
+bool FFMpegStream::prepareEncoder()
+{
+  if (copy_time_base_ || (sink_codec_ctx_ == nullptr)) {
+    return true;
+  }
+  bool okay = true;
+  std::call_once(setup_encoder_, [&] { okay = setupEncoder(); });
+  return okay && setup_;
+}
+
+
 bool FFMpegStream::setupEncoder()
 {
   assert(stream_);
   assert(sink_codec_ctx_);
   assert(codec_);
+  assert(sink_);
+
+  bool is_valid = false;
+  const auto queue_size = sink_->property<int32_t>(MediaProperty::ENCODE_QUEUE_SIZE, is_valid);
+  encode_.capacity_ = (is_valid && (queue_size > 0)) ? static_cast<size_t>(queue_size) : 0;
 
   sink_frame_.reset(av_frame_alloc());
   sink_frame_->pts = 0;
@@ -732,7 +1613,7 @@ bool FFMpegStream::setupEncoder()
         LCRITICAL("Failed to setup audio encoder");
       }
       setup_ = okay;
-      return sink_->writeHeader();
+      return okay && sink_->encoderReady();
     }
     case AVMEDIA_TYPE_VIDEO:
     {
@@ -741,7 +1622,7 @@ bool FFMpegStream::setupEncoder()
         LCRITICAL("Failed to setup video encoder");
       }
       setup_ = okay;
-      return sink_->writeHeader();
+      return okay && sink_->encoderReady();
     }
     default:
       break;
@@ -775,7 +1656,7 @@ bool checkSupportedSampleRates(const int* rates, const int32_t sample_rate)
 
 bool FFMpegStream::setupAudioEncoder(AVStream& stream, AVCodecContext& context, AVCodec& codec) const
 {
-  AVFormatContext fmt = sink_->formatContext();
+  const AVFormatContext& fmt = sink_->formatContext();
   assert(fmt.oformat);
   auto ret = avformat_query_codec(fmt.oformat, codec.id, FF_COMPLIANCE_NORMAL);
   if (ret != 1) {
@@ -865,7 +1746,7 @@ bool FFMpegStream::setupAudioEncoder(AVStream& stream, AVCodecContext& context,
 
 bool FFMpegStream::setupVideoEncoder(AVStream& stream, AVCodecContext& context, AVCodec& codec) const
 {
-  AVFormatContext fmt = sink_->formatContext();
+  const AVFormatContext& fmt = sink_->formatContext();
   assert(fmt.oformat);
   auto ret = avformat_query_codec(fmt.oformat, codec.id, FF_COMPLIANCE_NORMAL);
   if (ret != 1) {
@@ -946,7 +1827,8 @@ bool FFMpegStream::setupVideoEncoder(AVStream& stream, AVCodecContext& context,
   if (okay) {
     context.thread_count = threads;
   } else {
-    context.thread_count = static_cast<int>(std::thread::hardware_concurrency());
+    // Sized like the library's worker pool, which is configured for the process rather than the core count
+    context.thread_count = static_cast<int>(Executor::global()->workers());
     LINFO(fmt::format("Automatically setting thread count to {} threads", context.thread_count));
   }
   context.thread_type = FF_THREAD_SLICE;
@@ -994,13 +1876,6 @@ bool FFMpegStream::setupVideoEncoder(AVStream& stream, AVCodecContext& context,
   sink_frame_->width = dimensions.width;
   sink_frame_->height = dimensions.height;
   sink_frame_->format = context.pix_fmt;
-  ret = av_frame_get_buffer(sink_frame_.get(), 0);
-  if (ret < 0) {
-    av_strerror(ret, err.data(), ERR_LEN);
-    const auto msg = fmt::format("Failed to initialise buffers for video frame, msg={}", err.data());
-    LCRITICAL(msg);
-    return false;
-  }
 
   assert(pkt_);
   av_init_packet(pkt_);
@@ -1084,10 +1959,61 @@ bool FFMpegStream::setupDNXHDEncoder(AVCodecContext& ctx) const
 }
 
 
+int FFMpegStream::getBuffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+{
+  assert(ctx);
+  assert(frame);
+  const auto stream = static_cast<const FFMpegStream*>(ctx->opaque);
+  // Decoders without direct rendering expect the default buffer layout
+  if ( (stream == nullptr) || !stream->buffer_allocator_ || (ctx->codec == nullptr)
+       || ((ctx->codec->capabilities & AV_CODEC_CAP_DR1) == 0) || (frame->width <= 0) || (frame->height <= 0) ) {
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+  }
+  int width = frame->width;
+  int height = frame->height;
+  std::array<int, AV_NUM_DATA_POINTERS> align {};
+  avcodec_align_dimensions2(ctx, &width, &height, align.data());
+  const auto linesize_align = *std::max_element(align.begin(), align.end());
+  if (const auto ret = types::allocateFrameBuffer(*frame, stream->buffer_allocator_, width, height, linesize_align);
+      ret < 0) {
+    LWARNING("Failed to allocate a frame buffer from the application, using the default");
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+  }
+  return 0;
+}
+
+void FFMpegStream::extractPendingFrameProperties() const
+{
+  if (!frame_properties_pending_) {
+    return;
+  }
+  // Concurrent getters wait for the one extraction rather than reading the properties half set
+  std::call_once(frame_properties_once_, [this] {
+    // Streams are never created const so this only defers work the constructor would otherwise have done
+    auto& self = const_cast<FFMpegStream&>(*this);
+    // Don't disturb the playhead of a stream already being read
+    auto resume = resume_timestamp_;
+    if (!resume) {
+      std::lock_guard lock(self.read_ahead_.mutex_);
+      if (!read_ahead_.ring_.empty()) {
+        resume = read_ahead_.ring_.front().pts_;
+      }
+    }
+    if (!resume && (last_timestamp_ >= 0)) {
+      resume = last_timestamp_ + pts_intvl_;
+    }
+    self.stopReadAhead(true);
+    self.resume_timestamp_.reset();
+    self.extractFrameProperties();
+    self.resume_timestamp_ = resume;
+    frame_properties_pending_ = false;
+  });
+}
+
 void FFMpegStream::extractFrameProperties()
 {
   seek(0);
-  if (auto tmp_frame = this->frameByTimestamp()) {
+  if (auto tmp_frame = decodeByTimestamp(-1)) {
     delay_ = tmp_frame->timestamp();
     tmp_frame->extractProperties();
     bool is_valid;
@@ -1128,12 +2054,54 @@ void FFMpegStream::extractFrameProperties()
 
 MediaFramePtr FFMpegStream::frame(AVCodecContext& codec_ctx, const int stream_idx) const
 {
-  int err_code = 0;
+  return wrap(decode(codec_ctx, stream_idx));
+}
+
+
+media_handling::ffmpeg::types::AVPacketPtr FFMpegStream::nextPacket(const int stream_idx) const
+{
+  if (!demuxer_) {
+    return parent_->nextPacket(stream_idx);
+  }
+  while (true) {
+    auto pkt = parent_->allocatePacket();
+    assert(pkt);
+    if (const auto ret = av_read_frame(demuxer_.get(), pkt.get()); ret < 0) {
+      av_strerror(ret, err.data(), ERR_LEN);
+      LINFO(fmt::format("Failed to read frame: {}", err.data()));
+      return nullptr;
+    }
+    if (pkt->stream_index == stream_idx) {
+      return pkt;
+    }
+  }
+}
+
 
+AVFormatContext* FFMpegStream::demuxContext() const noexcept
+{
+  return demuxer_ ? demuxer_.get() : parent_->context();
+}
+
+
+media_handling::ffmpeg::types::AVFrameUPtr FFMpegStream::decode(AVCodecContext& codec_ctx, const int stream_idx) const
+{
   types::AVFrameUPtr frame(av_frame_alloc());
+  if (!decode(codec_ctx, stream_idx, *frame)) {
+    return nullptr;
+  }
+  LDEBUG(fmt::format("Frame received from decoder, pts={}", frame->pts));
+  return frame;
+}
+
+
+bool FFMpegStream::decode(AVCodecContext& codec_ctx, const int stream_idx, AVFrame& frame) const
+{
+  int err_code = 0;
+
   while (err_code >= 0)
   {
-    const auto pkt = parent_->nextPacket(stream_idx);
+    const auto pkt = nextPacket(stream_idx);
     // Send nulls to flush decoder
     err_code = avcodec_send_packet(&codec_ctx, pkt.get());
     if (err_code < 0) {
@@ -1144,18 +2112,10 @@ MediaFramePtr FFMpegStream::frame(AVCodecContext& codec_ctx, const int stream_id
 
     int dec_err_code = 0;
     while (dec_err_code >= 0) {
-      dec_err_code = avcodec_receive_frame(&codec_ctx, frame.get());
+      dec_err_code = avcodec_receive_frame(&codec_ctx, &frame);
       if (dec_err_code == 0) {
-        LDEBUG(fmt::format("Frame received from decoder, pts={}", frame->pts));
-        last_timestamp_ = frame->best_effort_timestamp;
-        // successful read
-        assert(type_ != media_handling::StreamType::UNKNOWN);
-        if ( (output_format_.swr_context_ != nullptr) || (output_format_.sws_context_ != nullptr) ) {
-          return std::make_shared<media_handling::ffmpeg::FFMpegMediaFrame>(std::move(frame),
-                                                                    type_ != StreamType::AUDIO,
-                                                                    output_format_);
-        }
-        return std::make_shared<media_handling::ffmpeg::FFMpegMediaFrame>(std::move(frame), type_ != StreamType::AUDIO);
+        last_timestamp_ = frame.best_effort_timestamp;
+        return true;
       }
 
       if (dec_err_code == AVERROR(EAGAIN)) {
@@ -1172,7 +2132,73 @@ MediaFramePtr FFMpegStream::frame(AVCodecContext& codec_ctx, const int stream_id
       }
     }//while
   }//while
-  return nullptr;
+  return false;
+}
+
+
+bool FFMpegStream::readNext(FrameBatch& batch)
+{
+  assert(codec_ctx_);
+  auto& slot = batch.slot();
+  if ( (read_ahead_.capacity_ > 0) || frame_cache_.enabled() || resume_timestamp_) {
+    // Frames come from elsewhere than the decoder
+    slot = frameByTimestamp(-1);
+    if (!slot) {
+      return false;
+    }
+    batch.commit();
+    return true;
+  }
+
+  const auto visual = type_ != StreamType::AUDIO;
+  FFMpegMediaFrame* recycled = nullptr;
+  if (slot.use_count() == 1) {
+    // No longer referenced by the caller so the frame and its conversion buffer can be reused
+    recycled = dynamic_cast<FFMpegMediaFrame*>(slot.get());
+    if ( (recycled != nullptr) && (recycled->isVisual() != visual) ) {
+      recycled = nullptr;
+    }
+  }
+  auto frame = recycled != nullptr ? recycled->release() : types::AVFrameUPtr(av_frame_alloc());
+  if (!decode(*codec_ctx_, stream_->index, *frame)) {
+    slot.reset();
+    return false;
+  }
+  if (recycled != nullptr) {
+    recycled->reset(std::move(frame), output_format_);
+  } else {
+    slot = wrap(std::move(frame));
+  }
+  batch.commit();
+  return true;
+}
+
+
+int64_t FFMpegStream::frameEnd(const IMediaFrame& frame, const int64_t previous) const
+{
+  const int64_t interval = std::max(pts_intvl_, 1);
+  // The frame's timestamp is the best-effort one decodeByTimestamp() matched it on
+  if (frame.timestamp() == AV_NOPTS_VALUE) {
+    return previous + interval;
+  }
+  bool is_valid;
+  const auto duration = static_cast<int64_t>(frame.property<Rational>(MediaProperty::DURATION, is_valid));
+  return frame.timestamp() + ( (is_valid && (duration > 0)) ? duration : interval);
+}
+
+
+MediaFramePtr FFMpegStream::wrap(types::AVFrameUPtr frame) const
+{
+  if (!frame) {
+    return nullptr;
+  }
+  assert(type_ != media_handling::StreamType::UNKNOWN);
+  if ( (output_format_.swr_context_ != nullptr) || (output_format_.sws_context_ != nullptr) ) {
+    return std::make_shared<media_handling::ffmpeg::FFMpegMediaFrame>(std::move(frame),
+                                                                      type_ != StreamType::AUDIO,
+                                                                      output_format_);
+  }
+  return std::make_shared<media_handling::ffmpeg::FFMpegMediaFrame>(std::move(frame), type_ != StreamType::AUDIO);
 }
 
 
@@ -1210,3 +2236,125 @@ bool FFMpegStream::setupSWR(FFMpegMediaFrame::InOutFormat& fmt,
   fmt.swr_context_ = std::shared_ptr<SwrContext>(ctx, types::swrContextDeleter);
   return true;
 }
+
+
+void FFMpegStream::startReadAhead()
+{
+  std::lock_guard lock(read_ahead_.mutex_);
+  if ( (read_ahead_.capacity_ == 0) || read_ahead_.active_) {
+    return;
+  }
+  if (!read_ahead_.executor_) {
+    read_ahead_.executor_ = Executor::global();
+  }
+  read_ahead_.stop_ = false;
+  read_ahead_.eos_ = false;
+  read_ahead_.active_ = true;
+  scheduleReadAhead();
+}
+
+
+void FFMpegStream::scheduleReadAhead()
+{
+  if (!read_ahead_.active_ || read_ahead_.stop_ || read_ahead_.eos_ || read_ahead_.running_
+      || (read_ahead_.ring_.size() >= read_ahead_.capacity_)) {
+    return;
+  }
+  assert(read_ahead_.executor_);
+  read_ahead_.running_ = true;
+  read_ahead_.executor_->submit([this] { readAhead(); });
+}
+
+
+void FFMpegStream::stopReadAhead(const bool flush)
+{
+  std::unique_lock lock(read_ahead_.mutex_);
+  read_ahead_.stop_ = true;
+  read_ahead_.cond_.wait(lock, [this] { return !read_ahead_.running_; });
+  read_ahead_.active_ = false;
+  if (flush) {
+    read_ahead_.ring_.clear();
+  } else {
+    // The output format may change before these are taken
+    for (auto& entry : read_ahead_.ring_) {
+      entry.converted_.reset();
+    }
+  }
+}
+
+
+void FFMpegStream::readAhead()
+{
+  while (true) {
+    {
+      std::lock_guard lock(read_ahead_.mutex_);
+      if (read_ahead_.stop_ || (read_ahead_.ring_.size() >= read_ahead_.capacity_)) {
+        read_ahead_.running_ = false;
+        read_ahead_.cond_.notify_all();
+        return;
+      }
+    }
+    ReadAheadEntry entry;
+    entry.frame_ = decode(*codec_ctx_, stream_->index);
+    if (entry.frame_) {
+      entry.pts_ = types::frameTimestamp(*entry.frame_);
+      entry.duration_ = entry.frame_->pkt_duration > 0 ? entry.frame_->pkt_duration : pts_intvl_;
+      if (read_ahead_.convert_) {
+        entry.converted_ = wrap(types::AVFrameUPtr(av_frame_clone(entry.frame_.get())));
+        entry.converted_->data();
+      }
+    }
+    std::lock_guard lock(read_ahead_.mutex_);
+    if (!entry.frame_) {
+      read_ahead_.eos_ = true;
+      read_ahead_.running_ = false;
+      read_ahead_.cond_.notify_all();
+      return;
+    }
+    read_ahead_.ring_.push_back(std::move(entry));
+    read_ahead_.cond_.notify_all();
+  }
+}
+
+
+MediaFramePtr FFMpegStream::takeReadAhead(const int64_t time_stamp)
+{
+  startReadAhead();
+  ReadAheadEntry entry;
+  {
+    std::unique_lock lock(read_ahead_.mutex_);
+    while (true) {
+      read_ahead_.cond_.wait(lock, [this] {
+        return !read_ahead_.ring_.empty() || read_ahead_.eos_ || read_ahead_.stop_;
+      });
+      if (read_ahead_.ring_.empty()) {
+        return nullptr;
+      }
+      const auto& front = read_ahead_.ring_.front();
+      if ( (time_stamp >= 0) && (time_stamp < front.pts_)) {
+        // Behind the playhead
+        return nullptr;
+      }
+      if ( (time_stamp == -1) || (time_stamp < (front.pts_ + front.duration_))) {
+        break;
+      }
+      const auto& back = read_ahead_.ring_.back();
+      if (time_stamp >= (back.pts_ + back.duration_ + pts_intvl_)) {
+        // Too far ahead to be worth waiting for
+        return nullptr;
+      }
+      // Not yet reached so discard what is passed
+      frame_cache_.insert(*front.frame_);
+      read_ahead_.ring_.pop_front();
+      scheduleReadAhead();
+    }
+    entry = std::move(read_ahead_.ring_.front());
+    read_ahead_.ring_.pop_front();
+    scheduleReadAhead();
+  }
+  frame_cache_.insert(*entry.frame_);
+  if (entry.converted_) {
+    return entry.converted_;
+  }
+  return wrap(std::move(entry.frame_));
+}
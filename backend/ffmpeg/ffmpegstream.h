@@ -29,15 +29,22 @@
 #define FFMPEGSTREAM_H
 
 #include "imediastream.h"
+#include "executor.h"
 #include <optional>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
 }
 
 
+#include "ffmpegframecache.h"
 #include "ffmpegmediaframe.h"
+#include "ffmpegpacketindex.h"
 #include "ffmpegsink.h"
 #include "ffmpegtypes.h"
 
@@ -54,11 +61,21 @@ namespace media_handling::ffmpeg
       FFMpegStream() = default;
       FFMpegStream(FFMpegSource* parent, AVStream* const stream);
       FFMpegStream(FFMpegSink* sink, const AVCodecID codec);
+      /**
+       * @brief             A stream of a sink that is written with packets copied from another container
+       * @param parameters  Codec parameters of the copied stream
+       * @param time_base   Time base of the copied packets' timestamps
+       */
+      FFMpegStream(FFMpegSink* sink, const AVCodecParameters& parameters, const AVRational time_base);
       ~FFMpegStream() override;
 
     public: // MediaPropertyObject overrides
       void setProperties(std::map<MediaProperty, std::any> props) override;
       void setProperty(const MediaProperty prop, const std::any& value) override;
+      bool hasProperty(const MediaProperty prop) const override;
+      std::any property(const MediaProperty prop, bool& is_valid) const override;
+      std::map<MediaProperty, std::any> properties() const override;
+      using MediaPropertyObject::property;
 
     public: // IMediaStream override
       bool index() override;
@@ -67,7 +84,10 @@ namespace media_handling::ffmpeg
       MediaFramePtr frameByTimestamp(const int64_t time_stamp=-1) final;
       MediaFramePtr frameBySecond(const double second=-1) final;
       MediaFramePtr frameByFrameNumber(const int64_t frame_number) final;
+      size_t frames(const int64_t start, const int64_t end, FrameBatch& batch) final;
+      size_t readBatch(const size_t count, FrameBatch& batch) final;
       bool writeFrame(MediaFramePtr sample) final;
+      bool flush() final;
       StreamType type() const final;
       int32_t sourceIndex() const noexcept final;
       bool setOutputFormat(const PixelFormat format,
@@ -76,6 +96,7 @@ namespace media_handling::ffmpeg
       bool setOutputFormat(const SampleFormat format, std::optional<SampleRate> rate = {}) final;
       bool setInputFormat(const PixelFormat format) final;
       bool setInputFormat(const SampleFormat format, std::optional<SampleRate> rate = {}) final;
+      bool setBufferAllocator(BufferAllocatorPtr allocator) final;
 
     public:
       /**
@@ -83,27 +104,141 @@ namespace media_handling::ffmpeg
        */
       void initialise() noexcept;
 
+      /**
+       * @brief Retrieve the packet index of this stream
+       * @note  This is empty until index() has been called
+       */
+      const FFMpegPacketIndex& packetIndex() const noexcept;
+
+      /**
+       * @brief The demuxed or muxed stream
+       * @note  i.e. for FFMpegSink::addCopyStream
+       */
+      AVStream* avStream() const noexcept;
+
+      /**
+       * @brief   Read this source stream's next packet without decoding it, i.e. to copy it with copyPacket()
+       * @note    Not to be mixed with decoding frames of this stream, which reads the same packets
+       * @return  packet or null at the end of the stream
+       */
+      types::AVPacketPtr readPacket();
+
+      /**
+       * @brief         Write a packet of the source stream this sink stream copies, without decoding it
+       * @note          Thread-safe with the writing of other streams of the sink
+       * @see           FFMpegSink::addCopyStream
+       * @param packet  Packet from readPacket() of the copied stream, which is left as it is
+       * @return        true==written or queued
+       */
+      bool copyPacket(const AVPacket& packet);
+
+      /**
+       * @brief   Set up this sink stream's encoder, if it has one and it isn't already, with its properties as set
+       * @note    Called by FFMpegSink::setupEncoders for every stream on the first write to any of them
+       * @return  true==set up or nothing to set up
+       */
+      bool prepareEncoder();
+
+      /**
+       * @brief       Cache decoded frames so that revisiting them does not require seeking and decoding
+       * @param bytes Maximum size of the decoded frames held. 0 disables the cache (default)
+       */
+      void setFrameCacheBudget(const size_t bytes);
+
+      /**
+       * @brief Retrieve the decoded frame cache of this stream, for its hit/miss statistics
+       */
+      const FFMpegFrameCache& frameCache() const noexcept;
+
+      /**
+       * @brief         Decode frames ahead of the playhead on the shared worker pool for sequential reads
+       * @note          The read-ahead is restarted from the new position whenever the stream seeks
+       * @param frames  Number of frames to hold ready. 0 disables read-ahead (default)
+       * @param convert Also perform the output conversion of frames on the background thread
+       */
+      void setReadAhead(const size_t frames, const bool convert = false);
+
+      /**
+       * @brief   Read this stream from its own demuxer instead of the one shared with the other streams of the source
+       * @note    Seeking and reading then has no effect on the other streams, at the cost of another open file.
+       *          The playhead is returned to the start of the stream
+       * @return  true==success
+       */
+      bool useIndependentDemuxer();
+
+      /**
+       * @brief         Decode at a reduced resolution where the decoder supports it (lowres i.e. MJPEG, JPEG2000),
+       *                rather than decoding at full resolution and downscaling
+       * @note          Applies to the next setOutputFormat() with smaller dimensions than the stream. The decoder is
+       *                reopened when the resolution changes, which returns the playhead to the start of the stream
+       * @param enabled true==reduce the decode resolution where possible
+       */
+      void setLowResolutionDecode(const bool enabled);
+      /**
+       * @brief The level of the reduced resolution decode, where decoded dimensions are divided by 2^level
+       */
+      int lowResolution() const noexcept;
+
+      /**
+       * @brief The number of threads requested of the decoder, from the THREADS property or else the share of the
+       *        decode thread budget
+       * @note  Codecs without threading support decode with one regardless
+       */
+      int32_t decoderThreads() const noexcept;
+
+      /**
+       * @brief         Decode only the keyframes of the stream, for fast thumbnails and proxies
+       * @note          Frames are returned with their own timestamps, not the ones requested. A timestamp request
+       *                returns the nearest keyframe once indexed, otherwise the one at or before it
+       * @param enabled true==keyframes only
+       */
+      void setKeyframesOnly(const bool enabled);
+      bool keyframesOnly() const noexcept;
+
+      /**
+       * @brief             Find the keyframe presented nearest to a timestamp
+       * @note              This requires the stream to have been indexed
+       * @param time_stamp  Timestamp in stream timebase units
+       * @return            Timestamp of the keyframe if found
+       */
+      std::optional<int64_t> nearestKeyframe(const int64_t time_stamp) const;
+
     private:
       FFMpegSource* parent_ {nullptr};
+      /**
+       * @brief A demuxer used by this stream only, instead of the parent's
+       */
+      types::AVFormatContextUPtr demuxer_ {nullptr};
       FFMpegSink* sink_ {nullptr};
       // TODO: use smart ptrs from ffmpegtypes.h
       AVStream* stream_ {nullptr};
       AVCodec* codec_ {nullptr};
       AVCodecContext* codec_ctx_ {nullptr};
       std::shared_ptr<AVCodecContext> sink_codec_ctx_ {nullptr};
+      /**
+       * @brief The encoder's frame format and next timestamp. Only audio conversion writes into its buffers
+       */
       types::AVFrameUPtr sink_frame_ {nullptr};
       AVPacket* pkt_ {nullptr};
       AVDictionary* opts_ {nullptr};
+      /**
+       * @brief The options the decoder was first opened with, for reopening it, as avcodec_open2 consumes opts_
+       */
+      AVDictionary* decoder_opts_ {nullptr};
       int pixel_format_{};
       FFMpegMediaFrame::InOutFormat output_format_;
       FFMpegMediaFrame::InOutFormat input_format_;
 
-      mutable int64_t last_timestamp_ {-1};
+      mutable std::atomic<int64_t> last_timestamp_ {-1};
       StreamType type_{StreamType::UNKNOWN};
       bool deinterlacer_setup_ {false};
       int32_t source_index_ {-1};
       std::once_flag setup_encoder_;
       int64_t audio_samples_ {0};
+      /**
+       * @brief The time base of the copied packets, for a sink stream that copies packets instead of encoding
+       */
+      std::optional<AVRational> copy_time_base_;
       std::atomic_bool setup_ {false};
       /**
        * @brief The interval between frames in multiples of timescale (frame duration)
@@ -114,6 +249,87 @@ namespace media_handling::ffmpeg
        *        AVStream.start_time or any other stream property reports the pts offset/delay
        */
       int64_t delay_{0};
+      FFMpegPacketIndex packet_index_;
+      FFMpegFrameCache frame_cache_;
+      /**
+       * @brief Where the next sequential read continues from, when the decoder is not already there
+       *        i.e. after a frame was retrieved from the cache
+       */
+      std::optional<int64_t> resume_timestamp_;
+      /**
+       * @brief Properties requiring a decoded frame have yet to be extracted
+       */
+      mutable std::atomic<bool> frame_properties_pending_ {false};
+      /**
+       * @brief Extracts the pending frame properties once, with concurrent getters waiting on it
+       */
+      mutable std::once_flag frame_properties_once_;
+      /**
+       * @brief Application memory the decoder outputs into, if set
+       */
+      BufferAllocatorPtr buffer_allocator_ {nullptr};
+      bool keyframes_only_ {false};
+      bool low_resolution_decode_ {false};
+      /**
+       * @brief The THREADS property of the decoder. 0 for a share of the decode thread budget
+       */
+      int32_t decoder_threads_ {0};
+      int32_t requested_threads_ {0};
+      ThreadType thread_type_ {ThreadType::AUTO};
+      struct ReadAheadEntry
+      {
+          types::AVFrameUPtr frame_ {nullptr};
+          /**
+           * @brief The frame already output-converted, if requested
+           */
+          MediaFramePtr converted_ {nullptr};
+          int64_t pts_ {0};
+          int64_t duration_ {0};
+      };
+      /**
+       * @brief Frames decoded by the background thread, in presentation order
+       */
+      struct {
+        /**
+         * @brief Runs the read-ahead as tasks, each decoding until the ring is full
+         */
+        ExecutorPtr executor_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        std::deque<ReadAheadEntry> ring_;
+        size_t capacity_ {0};
+        bool convert_ {false};
+        /**
+         * @brief Started and not since stopped
+         */
+        bool active_ {false};
+        /**
+         * @brief A task is queued or running
+         */
+        bool running_ {false};
+        bool stop_ {false};
+        bool eos_ {false};
+      } read_ahead_;
+      /**
+       * @brief Frames written but not yet encoded, when the sink encodes asynchronously
+       */
+      struct {
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        /**
+         * @brief In the order written. Holding the frames keeps their data valid until encoded
+         */
+        std::deque<MediaFramePtr> queue_;
+        /**
+         * @brief Zero to encode on the writing thread instead
+         */
+        size_t capacity_ {0};
+        /**
+         * @brief A task is queued or running
+         */
+        bool running_ {false};
+        bool failed_ {false};
+      } encode_;
 
     private:
       void extractProperties(const AVStream& stream, const AVCodecContext& context);
@@ -121,8 +337,67 @@ namespace media_handling::ffmpeg
       void extractVisualProperties(const AVStream& stream, const AVCodecContext& context);
       void extractAudioProperties(const AVStream& stream, const AVCodecContext& context);
       bool seek(const int64_t time_stamp);
-      void setupDecoder(const AVCodecID codec_id, AVDictionary* dict) const;
+      /**
+       * @brief Identify if the container is better seeked by byte position than by timestamp
+       */
+      bool seekableByBytes() const;
+      /**
+       * @brief The demuxer this stream reads from
+       */
+      AVFormatContext* demuxContext() const noexcept;
+      /**
+       * @brief Retrieve the next packet of the stream from its demuxer
+       */
+      types::AVPacketPtr nextPacket(const int stream_idx) const;
+      /**
+       * @brief         Replace the decoder with a newly opened one, with the current threading
+       * @param lowres  The lowres level of the new decoder
+       */
+      bool openDecoder(const int lowres);
+      /**
+       * @brief         Replace the decoder and return to the start of the stream
+       * @param lowres  The lowres level of the new decoder
+       */
+      bool reopenDecoder(const int lowres);
+      /**
+       * @brief Set the thread count and type of a decoder about to be opened
+       */
+      void setupThreads(AVCodecContext& ctx);
+      /**
+       * @brief Apply the THREADS and THREAD_TYPE properties to the decoder
+       */
+      void setDecoderThreads();
+      void setupDecoder(const AVCodecID codec_id, AVDictionary*& dict) const;
       bool setupEncoder();
+      /**
+       * @brief         Convert a video frame to the encoder's pixel format
+       * @param sample  Frame in the format set with setInputFormat()
+       * @return        A frame from the input format's pool, or null on failure
+       */
+      types::AVFrameUPtr convertInput(IMediaFrame& sample, const IMediaFrame::FrameData& data);
+      /**
+       * @brief         Reference a frame already in the encoder's format, without copying its data
+       * @param sample  Frame to be encoded, which is held until the encoder releases it
+       * @return        A frame sharing the sample's buffers, or null on failure
+       */
+      types::AVFrameUPtr referenceInput(const MediaFramePtr& sample, const IMediaFrame::FrameData& data);
+      /**
+       * @brief         Describe the planes of written video data, for frames without their own AVFrame
+       * @param format  Pixel format of the data
+       * @param frame   Frame whose data pointers and line sizes are set
+       * @return        true==success
+       */
+      bool describeInput(const IMediaFrame::FrameData& data, const AVPixelFormat format, AVFrame& frame) const;
+      /**
+       * @brief         Send a frame to the encoder and write the packets it produces
+       * @param sample  Frame or null to flush the encoder
+       * @return        true==success
+       */
+      bool encode(const MediaFramePtr& sample);
+      /**
+       * @brief Encode the queued frames, as a task on the library's executor
+       */
+      void encodeQueued();
       bool setupAudioEncoder(AVStream& stream, AVCodecContext& context, AVCodec& codec) const;
       bool setupVideoEncoder(AVStream& stream, AVCodecContext& context, AVCodec& codec) const;
       bool setupH264Encoder(AVCodecContext& ctx) const;
@@ -135,8 +410,69 @@ namespace media_handling::ffmpeg
        * @note  Certain properties are not in AVStream but can be found in AVFrame
        */
       void extractFrameProperties();
+      /**
+       * @brief AVCodecContext.get_buffer2 callback allocating frames from the buffer allocator
+       */
+      static int getBuffer(AVCodecContext* ctx, AVFrame* frame, int flags);
+      /**
+       * @brief Extract the frame properties if they were deferred on open
+       */
+      void extractPendingFrameProperties() const;
 
       MediaFramePtr frame(AVCodecContext& codec_ctx, const int stream_idx) const;
+      /**
+       * @brief Retrieve a frame by seeking and/or decoding on the calling thread
+       */
+      MediaFramePtr decodeByTimestamp(const int64_t time_stamp);
+      /**
+       * @brief Retrieve a keyframe by seeking to the one nearest to a timestamp
+       */
+      MediaFramePtr decodeKeyframe(const int64_t time_stamp);
+      /**
+       * @brief Decode the next frame of the stream without any output conversion
+       */
+      types::AVFrameUPtr decode(AVCodecContext& codec_ctx, const int stream_idx) const;
+      /**
+       * @brief Decode the next frame of the stream into an existing frame
+       * @note  Unlike decode() nothing is logged per frame, for batch reads
+       */
+      bool decode(AVCodecContext& codec_ctx, const int stream_idx, AVFrame& frame) const;
+      /**
+       * @brief   Decode the next frame of the stream into a batch, reusing the frame in the batch's slot if possible
+       * @return  true==frame added to the batch
+       */
+      bool readNext(FrameBatch& batch);
+      /**
+       * @brief           The timestamp the frame ends at, i.e. where the next frame starts
+       * @param previous  Where the previous frame ended, which a frame without a timestamp is taken to start at
+       */
+      int64_t frameEnd(const IMediaFrame& frame, const int64_t previous) const;
+      /**
+       * @brief Wrap a decoded frame for output, with conversion if an output format is set
+       */
+      MediaFramePtr wrap(types::AVFrameUPtr frame) const;
+
+      void startReadAhead();
+      /**
+       * @brief       Stop the read-ahead thread
+       * @param flush Discard the frames already read ahead
+       */
+      void stopReadAhead(const bool flush);
+      /**
+       * @brief Queue a read-ahead task if there is space in the ring and none is already queued
+       * @note  read_ahead_.mutex_ must be held
+       */
+      void scheduleReadAhead();
+      /**
+       * @brief Body of a read-ahead task
+       */
+      void readAhead();
+      /**
+       * @brief             Retrieve a frame from those already read ahead
+       * @param time_stamp  -1 for the next frame
+       * @return            frame or null if the frame has not been read ahead
+       */
+      MediaFramePtr takeReadAhead(const int64_t time_stamp);
 
       bool setupSWR(FFMpegMediaFrame::InOutFormat& fmt,
                     const ChannelLayout layout,
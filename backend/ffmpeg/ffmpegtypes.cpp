@@ -26,10 +26,15 @@
 */
 
 #include "ffmpegtypes.h"
+#include <algorithm>
+#include <array>
 #include <map>
 #include <mutex>
 #include <fmt/format.h>
 #include <cstdio>
+extern "C" {
+#include <libavutil/imgutils.h>
+}
 
 #include "mediahandling.h"
 
@@ -45,6 +50,22 @@ namespace
   // The ffmpeg log callback must be thread-safe
   std::mutex log_mutex;
 
+  constexpr auto BUFFER_ALIGNMENT = 64;
+  // Decoders may read beyond the last plane (see AV_INPUT_BUFFER_PADDING_SIZE)
+  constexpr auto BUFFER_PADDING = 16 + BUFFER_ALIGNMENT;
+
+  struct AllocatedBuffer
+  {
+      mh::BufferAllocatorPtr allocator_;
+      size_t size_;
+  };
+
+  void releaseBuffer(void* opaque, uint8_t* data)
+  {
+    const std::unique_ptr<AllocatedBuffer> buffer(static_cast<AllocatedBuffer*>(opaque));
+    buffer->allocator_->release(data, buffer->size_);
+  }
+
   const std::map<mh::SampleFormat, AVSampleFormat> SAMPLE_FORMAT_MAP
   {
     {mh::SampleFormat::NONE, AV_SAMPLE_FMT_NONE},
@@ -259,7 +280,12 @@ T_V convertToFFMpegType(const T_K mh_key, const std::map<T_K, T_V>& mapping, con
 
 void mft::avFormatContextDeleter(AVFormatContext* context)
 {
-  avformat_free_context(context);
+  if ( (context != nullptr) && (context->iformat != nullptr)) {
+    // Demuxers also own the input they opened
+    avformat_close_input(&context);
+  } else {
+    avformat_free_context(context);
+  }
 }
 
 void mft::avPacketDeleter(AVPacket* packet)
@@ -298,6 +324,58 @@ void mft::avStreamDeleter(AVStream* stream)
   // None. Should be freed by avformat
 }
 
+void mft::avCodecParametersDeleter(AVCodecParameters* parameters)
+{
+  avcodec_parameters_free(&parameters);
+}
+
+int64_t mft::frameTimestamp(const AVFrame& frame) noexcept
+{
+  return frame.best_effort_timestamp != AV_NOPTS_VALUE ? frame.best_effort_timestamp : frame.pts;
+}
+
+int mft::allocateFrameBuffer(AVFrame& frame, const BufferAllocatorPtr& allocator, const int width, const int height,
+                             const int align)
+{
+  if (!allocator) {
+    return AVERROR(EINVAL);
+  }
+  const auto format = static_cast<AVPixelFormat>(frame.format);
+  // Alignments are powers of two, so the larger satisfies both
+  const auto alignment = std::max(align, BUFFER_ALIGNMENT);
+  std::array<int, 4> linesizes {};
+  if (const auto ret = av_image_fill_linesizes(linesizes.data(), format, width); ret < 0) {
+    return ret;
+  }
+  for (auto& linesize : linesizes) {
+    linesize = FFALIGN(linesize, alignment);
+  }
+  std::array<uint8_t*, 4> planes {};
+  const auto image_size = av_image_fill_pointers(planes.data(), format, height, nullptr, linesizes.data());
+  if (image_size < 0) {
+    return image_size;
+  }
+  const auto size = static_cast<size_t>(image_size) + BUFFER_PADDING;
+  auto data = allocator->allocate(size, static_cast<size_t>(alignment));
+  if (data == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  auto holder = std::make_unique<AllocatedBuffer>(AllocatedBuffer{allocator, size});
+  frame.buf[0] = av_buffer_create(data, static_cast<int>(size), &releaseBuffer, holder.get(), 0);
+  if (frame.buf[0] == nullptr) {
+    allocator->release(data, size);
+    return AVERROR(ENOMEM);
+  }
+  holder.release();
+  av_image_fill_pointers(planes.data(), format, height, data, linesizes.data());
+  for (size_t i = 0; i < planes.size(); ++i) {
+    frame.data[i] = planes[i];
+    frame.linesize[i] = linesizes[i];
+  }
+  frame.extended_data = frame.data;
+  return 0;
+}
+
 void mft::logCallback(void* ptr, const int level, const char* msg_fmt, va_list vl)
 {
   if (level >= AV_LOG_DEBUG) {
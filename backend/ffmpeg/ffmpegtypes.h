@@ -31,6 +31,7 @@
 #include <memory>
 
 #include "types.h"
+#include "ibufferallocator.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -42,6 +43,10 @@ extern "C" {
 namespace media_handling::ffmpeg::types
 {
   // DELETERS
+  /**
+   * @brief Close a demuxer's input along with its context, as avformat_open_input() opened it. A muxer's context is
+   *        only freed, as FFMpegSink closes its output when writing the trailer
+   */
   void avFormatContextDeleter(AVFormatContext* context);
   void avPacketDeleter(AVPacket* packet);
   void avframeDeleter(AVFrame* frame);
@@ -50,6 +55,7 @@ namespace media_handling::ffmpeg::types
   void avCodecContextDeleter(AVCodecContext* context);
   void avCodecDeleter(AVCodec* codec);
   void avStreamDeleter(AVStream* stream);
+  void avCodecParametersDeleter(AVCodecParameters* parameters);
 
   // TYPEDEFS
   template <auto fn>
@@ -63,7 +69,25 @@ namespace media_handling::ffmpeg::types
   using AVFormatContextUPtr = std::unique_ptr<AVFormatContext, deleter_from_fn<avFormatContextDeleter>>;
   using AVCodecContextUPtr = std::unique_ptr<AVCodecContext, deleter_from_fn<avCodecContextDeleter>>;
   using AVStreamUPtr = std::unique_ptr<AVStream, deleter_from_fn<avStreamDeleter>>;
+  using AVCodecParametersUPtr = std::unique_ptr<AVCodecParameters, deleter_from_fn<avCodecParametersDeleter>>;
   
+  /**
+   * @brief           Allocate the buffer of a video frame from an application allocator
+   * @note            The frame's format, width and height have to be set already
+   * @param width     Width to allocate for, which may be padded beyond the frame's
+   * @param height    Height to allocate for, which may be padded beyond the frame's
+   * @param align     Alignment the line sizes and data need beyond the library's own, i.e. a decoder's
+   * @return          0 on success or an AVERROR
+   */
+  int allocateFrameBuffer(AVFrame& frame, const BufferAllocatorPtr& allocator, const int width, const int height,
+                          const int align = 0);
+
+  /**
+   * @brief The decoder's estimate of a frame's presentation time, as pts is unset for many AVI, raw and ES inputs
+   * @return best_effort_timestamp, or pts if there is no estimate
+   */
+  int64_t frameTimestamp(const AVFrame& frame) noexcept;
+
   /**
    * @brief Logging callback for libav messages
    */